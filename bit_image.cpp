@@ -0,0 +1,109 @@
+/*******************************************************************************
+
+  @file      bit_image.cpp
+  @brief     1 bit per pixel binary image, count bright pixels by words
+  @details   ~
+  @author    LemonDecoder contributors
+  @date      18.10.2026
+  @copyright LemonDecoder contributors, 2026. MIT License(see LICENSE.txt)
+
+*******************************************************************************/
+#include "bit_image.h"
+
+using std::vector;
+using namespace cv;
+
+namespace hyf_lemon {
+
+BitImage::BitImage() : rows_(0), cols_(0), row_words_(0), col_words_(0) {}
+BitImage::BitImage(const Mat& binary)
+    : rows_(0), cols_(0), row_words_(0), col_words_(0) {
+  Pack(binary);
+}
+BitImage::~BitImage() { Release(); }
+
+void BitImage::Release() {
+  rows_ = cols_ = row_words_ = col_words_ = 0;
+  vector<uint64_t>().swap(bits_);
+  vector<uint64_t>().swap(bits_t_);
+}
+
+void BitImage::Pack(const Mat& binary) {
+  rows_ = binary.rows;
+  cols_ = binary.cols;
+  row_words_ = (cols_ + 63) >> 6;
+  col_words_ = (rows_ + 63) >> 6;
+  bits_.assign((size_t)rows_ * row_words_, 0);
+  bits_t_.assign((size_t)cols_ * col_words_, 0);
+  if (empty()) return;
+
+  // the transposed plane is filled 64 rows a time, so that the source is
+  // still read row by row
+  vector<uint64_t> column(cols_);
+  int x, y;
+  for (int y_block = 0; y_block < rows_; y_block += 64) {
+    std::fill(column.begin(), column.end(), 0);
+    int y_end = y_block + 64 < rows_ ? y_block + 64 : rows_;
+    for (y = y_block; y < y_end; y++) {
+      const uchar* p = binary.ptr<uchar>(y);
+      uint64_t* row = &bits_[(size_t)y * row_words_];
+      const uint64_t bit_y = 1ULL << (y - y_block);
+      for (x = 0; x < cols_; x++) {
+        if (p[x] == 0) continue;
+        row[x >> 6] |= 1ULL << (x & 63);
+        column[x] |= bit_y;
+      }
+    }
+    for (x = 0; x < cols_; x++)
+      bits_t_[(size_t)x * col_words_ + (y_block >> 6)] = column[x];
+  }
+}
+
+int BitImage::CountWords(const uint64_t* words, int begin, int end) {
+  /* count bits [begin, end) of a packed line */
+  if (begin >= end) return 0;
+  int first = begin >> 6, last = (end - 1) >> 6;
+  uint64_t head = ~0ULL << (begin & 63);
+  uint64_t tail = ~0ULL >> (63 - ((end - 1) & 63));
+  if (first == last) return PopCount64(words[first] & head & tail);
+
+  int count = PopCount64(words[first] & head);
+  for (int i = first + 1; i < last; i++) count += PopCount64(words[i]);
+  count += PopCount64(words[last] & tail);
+  return count;
+}
+
+int BitImage::CountRow(const int y, int x0, int x1) const {
+  if (y < 0 || y >= rows_) return 0;
+  if (x0 < 0) x0 = 0;
+  if (x1 > cols_) x1 = cols_;
+  return CountWords(&bits_[(size_t)y * row_words_], x0, x1);
+}
+
+int BitImage::CountCol(const int x, int y0, int y1) const {
+  if (x < 0 || x >= cols_) return 0;
+  if (y0 < 0) y0 = 0;
+  if (y1 > rows_) y1 = rows_;
+  return CountWords(&bits_t_[(size_t)x * col_words_], y0, y1);
+}
+
+void BitImage::EdgeProfiles(vector<int>* row_edges,
+                            vector<int>* col_edges) const {
+  if (row_edges != NULL) LineEdges(bits_, rows_, row_words_, row_edges);
+  if (col_edges != NULL) LineEdges(bits_t_, cols_, col_words_, col_edges);
+}
+
+void BitImage::LineEdges(const vector<uint64_t>& plane, const int lines,
+                         const int words, vector<int>* edges) {
+  // the padding bits of the last word are 0 in every line, never counted
+  edges->assign(lines, 0);
+  for (int i = 1; i < lines; i++) {
+    const uint64_t* prev = &plane[(size_t)(i - 1) * words];
+    const uint64_t* line = prev + words;
+    int count = 0;
+    for (int k = 0; k < words; k++) count += PopCount64(prev[k] ^ line[k]);
+    (*edges)[i] = count;
+  }
+}
+
+}  // namespace hyf_lemon
@@ -0,0 +1,102 @@
+/*******************************************************************************
+
+  @file      bit_image.h
+  @brief     1 bit per pixel binary image, count bright pixels by words
+  @details   ~
+  @author    LemonDecoder contributors
+  @date      18.10.2026
+  @copyright LemonDecoder contributors, 2026. MIT License(see LICENSE.txt)
+
+*******************************************************************************/
+#ifndef BIT_IMAGE_H_
+#define BIT_IMAGE_H_
+
+#include <stdint.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include <opencv2/opencv.hpp>
+
+namespace hyf_lemon {
+
+/**
+  @brief count the 1 bits of a word
+**/
+inline int PopCount64(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(word);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  return (int)__popcnt64(word);
+#else
+  word = word - ((word >> 1) & 0x5555555555555555ULL);
+  word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+  word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (int)((word * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+  @class   BitImage
+  @brief   a binarized image(0/255) packed into 64 bit words, bit x%64 of
+           word x/64 in a row is the pixel x. a transposed copy is kept too,
+           so that both rows and columns are counted by words.
+  @details pixels out of the image are dark(0)
+**/
+class BitImage {
+ public:
+  BitImage();
+  explicit BitImage(const cv::Mat& binary);
+  ~BitImage();
+
+  /**
+    @brief pack a CV_8UC1 binarized image, none zero pixels are bright
+  **/
+  void Pack(const cv::Mat& binary);
+  void Release();
+
+  bool empty() const { return rows_ == 0 || cols_ == 0; }
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+
+  /**
+    @retval 1 - if the pixel is bright, 0 - if dark or out of the image
+  **/
+  int Get(const int x, const int y) const {
+    if (x < 0 || y < 0 || x >= cols_ || y >= rows_) return 0;
+    return (int)(bits_[(size_t)y * row_words_ + (x >> 6)] >> (x & 63)) & 1;
+  }
+  int Get(const cv::Point& p) const { return Get(p.x, p.y); }
+
+  /**
+    @brief count bright pixels of row y, from x0 to x1(excluded)
+  **/
+  int CountRow(const int y, int x0, int x1) const;
+  /**
+    @brief count bright pixels of column x, from y0 to y1(excluded)
+  **/
+  int CountCol(const int x, int y0, int y1) const;
+  /**
+    @brief edge profiles, by XOR of the neighbouring lines: row_edges[y]
+           counts the pixels of row y that differ from row y - 1, col_edges[x]
+           those of column x that differ from column x - 1. [0] is 0
+  **/
+  void EdgeProfiles(std::vector<int>* row_edges,
+                    std::vector<int>* col_edges) const;
+
+ private:
+  static int CountWords(const uint64_t* words, int begin, int end);
+  static void LineEdges(const std::vector<uint64_t>& plane, const int lines,
+                        const int words, std::vector<int>* edges);
+
+  int rows_;
+  int cols_;
+  int row_words_;
+  int col_words_;
+  std::vector<uint64_t> bits_;
+  std::vector<uint64_t> bits_t_;
+};
+
+}  // namespace hyf_lemon
+
+#endif  // BIT_IMAGE_H_
@@ -146,6 +146,7 @@ DatamatrixDecoder::DatamatrixDecoder(const int numRows, const int numColumns,
                      const vector<int>& codesTotal) {
   this->numRows = numRows;
   this->numColumns = numColumns;
+  this->rejectReason = REJECT_NONE;
   // ECC info
   int i;
   for (i = 0; i < sizeof(totalRows) / sizeof(int); i++) {
@@ -214,8 +215,15 @@ DatamatrixDecoder::~DatamatrixDecoder(void) {
 
 bool DatamatrixDecoder::decode(vector<int>* message) {
   getWords();
-  if (repair() == CANT_REPAIR) return false;
-  return getMessage(message);
+  if (repair() == CANT_REPAIR) {
+    rejectReason = REJECT_REPAIR;
+    return false;
+  }
+  if (!getMessage(message)) {
+    rejectReason = REJECT_MESSAGE;
+    return false;
+  }
+  return true;
 }
 
 
@@ -13,6 +13,8 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "reject_stats.h"
+
 namespace hyf_lemon {
 
 class DatamatrixDecoder {
@@ -21,6 +23,8 @@ class DatamatrixDecoder {
                     const std::vector<int> &codes);
   ~DatamatrixDecoder();
   bool decode(std::vector<int> *message);
+  // why decode failed, REJECT_NONE if it did not
+  RejectReason reject() const { return rejectReason; }
 
  private:
   int numRows;
@@ -32,6 +36,7 @@ class DatamatrixDecoder {
   int dataNum;
   int correctorNum;
   int totalNum;
+  RejectReason rejectReason;
 
  private:
   //-------------------get codewords from matrix--------
@@ -12,6 +12,8 @@
 
 #include "datamatrix_locator.h"
 
+#include <limits.h>
+
 #include <iostream>
 
 using std::cout;
@@ -21,6 +23,156 @@ using namespace cv;
 
 namespace hyf_lemon {
 
+/**
+ * @brief Douglas-Peucker on a closed contour, output the indexes kept
+ */
+static void SimplifyContour(const PointSeq& points, const double epsilon,
+                            vector<size_contour>* kept) {
+  const size_contour total = (size_contour)points.size();
+  // the farthest point from the first one splits the closed contour in 2
+  size_contour i, far = 0;
+  int max_d = -1;
+  for (i = 1; i < total; i++) {
+    int d = GetDistancePow(points[0], points[i]);
+    if (d > max_d) max_d = d, far = i;
+  }
+  vector<uchar> keep(total, 0);
+  keep[0] = keep[far] = 1;
+  // ranges(first, last) to check, last == total means back to 0
+  vector<std::pair<size_contour, size_contour>> ranges = {{0, far},
+                                                          {far, total}};
+  const double eps_sqr = epsilon * epsilon;
+  while (!ranges.empty()) {
+    size_contour first = ranges.back().first, last = ranges.back().second;
+    ranges.pop_back();
+    if (last - first < 2) continue;
+    const Point a = points[first], b = points[last % total];
+    const double dx = b.x - a.x, dy = b.y - a.y;
+    const double len_sqr = dx * dx + dy * dy;
+    double max_dist = -1.0;
+    size_contour max_i = first;
+    for (i = first + 1; i < last; i++) {
+      double ex = points[i].x - a.x, ey = points[i].y - a.y;
+      double cross = ex * dy - ey * dx;
+      double dist = len_sqr > 0 ? cross * cross / len_sqr : ex * ex + ey * ey;
+      if (dist > max_dist) max_dist = dist, max_i = i;
+    }
+    if (max_dist <= eps_sqr) continue;
+    keep[max_i] = 1;
+    ranges.push_back({first, max_i});
+    ranges.push_back({max_i, last});
+  }
+  kept->clear();
+  for (i = 0; i < total; i++)
+    if (keep[i]) kept->push_back(i);
+}
+
+void Contour::Build(const PointSeq& points, const double epsilon) {
+  total = (size_contour)points.size();
+  this->points = &points;
+  origin.clear();
+  weight.clear();
+  size_contour i;
+  if (epsilon > 0.0 && total > 2) {
+    SimplifyContour(points, epsilon, &origin);
+    const size_contour n = (size_contour)origin.size();
+    x.resize(n);
+    y.resize(n);
+    weight.resize(n);
+    for (i = 0; i < n; i++) {
+      x[i] = points[origin[i]].x;
+      y[i] = points[origin[i]].y;
+      size_contour next = i + 1 < n ? origin[i + 1] : origin[0] + total;
+      weight[i] = (int)(next - origin[i]);
+    }
+  } else {
+    x.resize(total);
+    y.resize(total);
+    for (i = 0; i < total; i++) {
+      x[i] = points[i].x;
+      y[i] = points[i].y;
+    }
+  }
+  const size_contour n_points = size();
+  for (int j = 0; j < 4; j++) {
+    extreme[j].location = nearest[j].location = Point(0, 0);
+    extreme[j].index = nearest[j].index = -1;
+    side_counts[j] = 0;
+  }
+  bound = Rect();
+  if (n_points == 0) return;
+
+  // pass 1: bound, and the first point met at each side of it
+  int top = y[0], left = x[0], bottom = y[0], right = x[0];
+  size_contour i_top = 0, i_left = 0, i_bottom = 0, i_right = 0;
+  for (i = 1; i < n_points; i++) {
+    const int xi = x[i], yi = y[i];
+    if (yi < top) top = yi, i_top = i;
+    if (xi < left) left = xi, i_left = i;
+    if (yi > bottom) bottom = yi, i_bottom = i;
+    if (xi > right) right = xi, i_right = i;
+  }
+  bound = Rect(left, top, right - left + 1, bottom - top + 1);
+  const size_contour i_extreme[] = {i_top, i_left, i_bottom, i_right};
+  for (int j = 0; j < 4; j++) {
+    extreme[j].location = at(i_extreme[j]);
+    extreme[j].index = i_extreme[j];
+  }
+
+  // pass 2: the closest point to each bound vertex, points beside each side
+  const int vertex_x[] = {bound.x, bound.x, bound.x + bound.width,
+                          bound.x + bound.width};
+  const int vertex_y[] = {bound.y, bound.y + bound.height,
+                          bound.y + bound.height, bound.y};
+  int distance[] = {INT_MAX, INT_MAX, INT_MAX, INT_MAX};
+  size_contour i_nearest[] = {0, 0, 0, 0};
+  int n_top = 0, n_left = 0, n_bottom = 0, n_right = 0;
+  if (weight.empty()) {
+    for (i = 0; i < n_points; i++) {
+      const int xi = x[i], yi = y[i];
+      for (int j = 0; j < 4; j++) {
+        int dx = xi - vertex_x[j], dy = yi - vertex_y[j];
+        int d = dx * dx + dy * dy;
+        if (d < distance[j]) distance[j] = d, i_nearest[j] = i;
+      }
+      n_top += yi - bound.y < kSideGap;
+      n_left += xi - bound.x < kSideGap;
+      n_bottom += bound.y + bound.height - yi < kSideGap;
+      n_right += bound.x + bound.width - xi < kSideGap;
+    }
+  } else {
+    // the points of an edge beside a side(both ends beside it) are all
+    // counted, otherwise only the vertex
+    for (i = 0; i < n_points; i++) {
+      const int xi = x[i], yi = y[i];
+      const size_contour next = i + 1 < n_points ? i + 1 : 0;
+      const int xn = x[next], yn = y[next];
+      for (int j = 0; j < 4; j++) {
+        int dx = xi - vertex_x[j], dy = yi - vertex_y[j];
+        int d = dx * dx + dy * dy;
+        if (d < distance[j]) distance[j] = d, i_nearest[j] = i;
+      }
+      const int w = weight[i];
+      if (yi - bound.y < kSideGap)
+        n_top += yn - bound.y < kSideGap ? w : 1;
+      if (xi - bound.x < kSideGap)
+        n_left += xn - bound.x < kSideGap ? w : 1;
+      if (bound.y + bound.height - yi < kSideGap)
+        n_bottom += bound.y + bound.height - yn < kSideGap ? w : 1;
+      if (bound.x + bound.width - xi < kSideGap)
+        n_right += bound.x + bound.width - xn < kSideGap ? w : 1;
+    }
+  }
+  for (int j = 0; j < 4; j++) {
+    nearest[j].location = at(i_nearest[j]);
+    nearest[j].index = i_nearest[j];
+  }
+  side_counts[0] = n_top;
+  side_counts[1] = n_left;
+  side_counts[2] = n_bottom;
+  side_counts[3] = n_right;
+}
+
 int GetDistancePow(Point p1, Point p2) {
   return (p1.x - p2.x) * (p1.x - p2.x) + (p1.y - p2.y) * (p1.y - p2.y);
 }
@@ -47,16 +199,34 @@ double GetAngleF(Point p0, Point p1) {
   return angle;
 }
 
+/**
+ * @brief atan in degrees for the first octant: a ratio (0~1) is looked up by
+ * kAtanBins bins, then the bound of its degree is checked exactly
+ */
+static const int kAtanBins = 1024;
+static struct AtanTable {
+  AtanTable() {
+    for (int k = 0; k <= 45; k++) tan_half[k] = tan(CV_PI * (k + 0.5) / 180.0);
+    for (int r = 0; r <= kAtanBins; r++)
+      degree[r] = (uchar)floor(atan((double)r / kAtanBins) * 180 / CV_PI + 0.5);
+  }
+  // tan(k + 0.5 degree), where the rounded degree turns to k + 1
+  double tan_half[46];
+  uchar degree[kAtanBins + 1];
+} atan_table;
+
 int GetAngle(Point p0, Point p1) {
-  double deltaX = p0.x - p1.x;
-  double deltaY = p0.y - p1.y;
-  double thita = 0.0;
-  int angle = 0;
-  if (deltaX != 0.0) {
-    thita = atan(deltaY / deltaX);
-    angle = (int)floor(thita * 180 / CV_PI + 0.5);
-  } else
-    angle = 90;
+  /* same as atan(deltaY / deltaX) rounded to degree, without atan: reduced
+   * to the first octant, looked up, then back */
+  const int deltaX = p0.x - p1.x;
+  const int deltaY = p0.y - p1.y;
+  if (deltaX == 0) return 90;
+  const int abs_x = abs(deltaX), abs_y = abs(deltaY);
+  const int lo = std::min(abs_x, abs_y), hi = std::max(abs_x, abs_y);
+  int k = atan_table.degree[(int)((long long)lo * kAtanBins / hi)];
+  while (k < 45 && lo >= hi * atan_table.tan_half[k]) k++;
+  int angle = abs_y <= abs_x ? k : 90 - k;
+  if ((deltaX < 0) != (deltaY < 0)) angle = -angle;
   if (angle > 0)
     angle = 180 - angle;
   else
@@ -65,7 +235,7 @@ int GetAngle(Point p0, Point p1) {
   return angle;
 }
 
-int GetPixValue8UC1(const Mat image, Point point) {
+int GetPixValue8UC1(const Mat& image, Point point) {
   int channel = image.channels();
   int step = (int)image.step;
   int idx = point.y * step + point.x * channel;
@@ -74,6 +244,21 @@ int GetPixValue8UC1(const Mat image, Point point) {
   return (uchar)image.data[idx];
 }
 
+double GetGrayBilinear(const Mat& gray, double x, double y) {
+  if (x < 0.0) x = 0.0;
+  if (y < 0.0) y = 0.0;
+  if (x > gray.cols - 1) x = gray.cols - 1;
+  if (y > gray.rows - 1) y = gray.rows - 1;
+  int x0 = (int)x, y0 = (int)y;
+  int x1 = x0 + 1 < gray.cols ? x0 + 1 : x0;
+  int y1 = y0 + 1 < gray.rows ? y0 + 1 : y0;
+  double fx = x - x0, fy = y - y0;
+  const uchar* row0 = gray.ptr<uchar>(y0);
+  const uchar* row1 = gray.ptr<uchar>(y1);
+  return (row0[x0] * (1 - fx) + row0[x1] * fx) * (1 - fy) +
+         (row1[x0] * (1 - fx) + row1[x1] * fx) * fy;
+}
+
 Point MovePixel(const Point p0, const double angle, const int step,
                 const int direction) {
   Point p;
@@ -85,35 +270,98 @@ Point MovePixel(const Point p0, const double angle, const int step,
   return p;
 }
 
-double GetBrightRateInALine(const Mat binary, const Point p0,
+LineSampler::LineSampler(const Point p0, const double angle,
+                         const int direction) {
+  const double radian = CV_PI * angle / 180.0;
+  p0_ = p0;
+  step_x_ = (int64_t)floor(-direction * cos(radian) * (double)kOne + 0.5);
+  step_y_ = (int64_t)floor(direction * sin(radian) * (double)kOne + 0.5);
+}
+
+int LineSampler::Count(const BitImage& binary, const int length,
+                       const int limit) const {
+  int64_t x = (int64_t)p0_.x * kOne + kOne / 2;
+  int64_t y = (int64_t)p0_.y * kOne + kOne / 2;
+  int n_bright = 0;
+  for (int i = 0; i < length && n_bright < limit;
+       i++, x += step_x_, y += step_y_)
+    n_bright += binary.Get((int)(x >> 32), (int)(y >> 32));
+  return n_bright;
+}
+
+void LineSampler::Sample(const BitImage& binary, const int length,
+                         uchar* line) const {
+  int64_t x = (int64_t)p0_.x * kOne + kOne / 2;
+  int64_t y = (int64_t)p0_.y * kOne + kOne / 2;
+  for (int i = 0; i < length; i++, x += step_x_, y += step_y_)
+    line[i] = (uchar)binary.Get((int)(x >> 32), (int)(y >> 32));
+}
+
+bool GetAxisStep(const double angle, const int direction, int* dx, int* dy) {
+  double quarter = angle / 90.0;
+  if (quarter != floor(quarter)) return false;
+  // same as MovePixel: x - direction * cos, y + direction * sin
+  switch ((((int)quarter % 4) + 4) % 4) {
+    case 0:
+      *dx = -direction, *dy = 0;
+      break;
+    case 1:
+      *dx = 0, *dy = direction;
+      break;
+    case 2:
+      *dx = direction, *dy = 0;
+      break;
+    default:
+      *dx = 0, *dy = -direction;
+      break;
+  }
+  return true;
+}
+
+double GetBrightRateInALine(const BitImage& binary, const Point p0,
                             const double angle, const int L,
-                            const int direction) {
-  Point track;
+                            const int direction, const double max_rate) {
+  if (L <= 0) return 0.0;
   int n_bright = 0;
-  for (int i = 0; i < L; i++) {
-    track = MovePixel(p0, angle, i, direction);
-    if (GetPixValue8UC1(binary, track) == 255) n_bright++;
+  int dx, dy;
+  if (GetAxisStep(angle, direction, &dx, &dy)) {
+    // horizontal/vertical: count by words
+    Point p1(p0.x + dx * (L - 1), p0.y + dy * (L - 1));
+    if (dy == 0)
+      n_bright = binary.CountRow(p0.y, std::min(p0.x, p1.x),
+                                 std::max(p0.x, p1.x) + 1);
+    else
+      n_bright = binary.CountCol(p0.x, std::min(p0.y, p1.y),
+                                 std::max(p0.y, p1.y) + 1);
+    return (double)n_bright / L;
   }
+
+  // the least count that reaches max_rate, as the rate is compared
+  int limit = (int)ceil(max_rate * L);
+  if ((double)limit / L < max_rate) limit++;
+  n_bright = LineSampler(p0, angle, direction).Count(binary, L, limit);
   return (double)n_bright / L;
 }
 
-int GetDashNumberBright(const Mat binary, const Point p0, const double angle,
-                        const int length, const int direction) {
+int GetDashNumberBright(const BitImage& binary, const Point p0,
+                        const double angle, const int length,
+                        const int direction) {
   int kMinIsland = 1;
-  Point track;
+  if (length <= 0) return 0;
+  vector<uchar> line(length);
+  LineSampler(p0, angle, direction).Sample(binary, length, line.data());
   vector<int> bright_island;
   bool is_bright = false;
   int position;
   int n_dash = 0;
   // check each point
   for (int i = 0; i < length; i++) {
-    track = MovePixel(p0, angle, i, direction);
-    if (!is_bright && GetPixValue8UC1(binary, track) == 255) {
+    if (!is_bright && line[i] == 1) {
       is_bright = true;
       position = i;
     }
     if (is_bright) {
-      if (GetPixValue8UC1(binary, track) == 0 || i == length - 1) {
+      if (line[i] == 0 || i == length - 1) {
         is_bright = false;
         bright_island.push_back(i - position);
       }
@@ -127,18 +375,99 @@ int GetDashNumberBright(const Mat binary, const Point p0, const double angle,
   return n_dash;
 }
 
+int CountDashes(const vector<uchar>& line) {
+  const int kMinIsland = 1;
+  const double kMin2MaxRate = 0.3;
+  const int length = (int)line.size();
+  vector<int> bright_island;
+  vector<int> dark_island;
+  bool is_bright = false;
+  int position_bright = -1;
+  int position_dark = -1;
+  int n_bright = 0, n_dark = 0;
+
+  // check each point
+  for (int i = 0; i < length; i++) {
+    if (!is_bright) {
+      if (length - 1 == i)
+        dark_island.push_back(i - position_dark + 1);
+      else if (line[i] == 1) {
+        is_bright = true;
+        position_bright = i;
+        if (position_dark != -1) dark_island.push_back(i - position_dark);
+      }
+    }
+    if (is_bright) {
+      if (i == length - 1)
+        bright_island.push_back(i - position_bright + 1);
+      else if (line[i] == 0) {
+        is_bright = false;
+        bright_island.push_back(i - position_bright);
+        position_dark = i;
+      }
+    }
+  }
+
+  // count and ignore little island
+  int min = 10000, max = 0;
+  int current, j;
+  for (j = 0; j < bright_island.size(); j++) {
+    current = bright_island[j];
+    if (current > kMinIsland) {
+      n_bright++;
+      if (current < min) min = current;
+      if (current > max) max = current;
+    }
+  }
+  bright_island.clear();
+  vector<int>().swap(bright_island);
+  if (double(min) / max < kMin2MaxRate) {
+    dark_island.clear();
+    vector<int>().swap(dark_island);
+    return -1;
+  }
+  //
+  min = 10000, max = 0;
+  for (j = 0; j < dark_island.size(); j++) {
+    current = dark_island[j];
+    if (current > kMinIsland) {
+      n_dark++;
+      if (current < min) min = current;
+      if (current > max) max = current;
+    }
+  }
+  dark_island.clear();
+  vector<int>().swap(dark_island);
+  if (double(min) / max < kMin2MaxRate) return -1;
+  // printf("bright+dark:%d,%d\n", n_bright, n_dark);
+  if (n_bright == n_dark || n_bright - n_dark == 1) return n_dark + n_dark;
+
+  return -1;
+}
+
 /****************************************************************************
  *                                   class                                   *
  ****************************************************************************/
 
-DatamatrixLocator::DatamatrixLocator() { }
+DatamatrixLocator::DatamatrixLocator() {
+  threads_ = 0;
+  subpixel_ = false;
+  simplify_ = 0.0;
+  min_module_ = 4;
+}
 DatamatrixLocator::DatamatrixLocator(const Mat& source,
                                      const vector<PointSeq>& contours) {
-  image_ = source;
+  threads_ = 0;
+  subpixel_ = false;
+  simplify_ = 0.0;
+  min_module_ = 4;
+  set_image(source);
   contours_ = contours;
 }
 DatamatrixLocator::~DatamatrixLocator() {
   image_.release();
+  bits_.Release();
+  vector<Scored>().swap(scored_);
   vector<PointSeq>().swap(contours_);
 }
 
@@ -147,75 +476,120 @@ void DatamatrixLocator::set_image(const Mat& source) {
     image_.release();
   }
   image_ = source;
+  bits_.Pack(source);
+}
+
+void DatamatrixLocator::set_image(const Mat& source, const BitImage& bits) {
+  if (!image_.empty()) {
+    image_.release();
+  }
+  image_ = source;
+  bits_ = bits;
 }
 
 void DatamatrixLocator::set_contours(const vector<PointSeq> contours) {
+  // the kept contours point to the old ones
+  vector<Scored>().swap(scored_);
   vector<PointSeq>().swap(contours_);
   contours_ = contours;
 }
 
+void DatamatrixLocator::ScoreContours(vector<double>* scores) {
+  const int n_contours = (int)contours_.size();
+  scores->assign(n_contours, 0.0);
+  // each slot is written by its own contour only
+  scored_.assign(n_contours, Scored());
+  if (threads_ == 1 || n_contours < 2) {
+    for (int i = 0; i < n_contours; i++)
+      (*scores)[i] = ScoreCandidate(contours_[i], &scored_[i]);
+  } else {
+    parallel_for_(Range(0, n_contours), [&](const Range& range) {
+      for (int i = range.start; i < range.end; i++)
+        (*scores)[i] = ScoreCandidate(contours_[i], &scored_[i]);
+    });
+  }
+}
+
+bool DatamatrixLocator::FindLShape(const PointSeq& points, Scored* scored,
+                                   double* straightness) {
+  // split into x[], y[] with the statistics, walked only once here
+  Contour& contour = scored->contour;
+  contour.Build(points, simplify_);
+  // the 4 vertex points in a contour
+  XPoint vertex[4];
+  // bounding rect
+  Rect bound = GetBoundingRect(contour, vertex);
+  // l_shape for each contour
+  LShape& l_shape = scored->l_shape;
+  l_shape.position = -1;  // empty
+  l_shape.angle1 = l_shape.angle2 = 0.0;
+  l_shape.reversed = false;
+  // Check if is Orthogonal, meanwhile get l_shape if is, it is faster
+  scored->orthogonal = CheckOrthogonal(contour, &l_shape);
+  // if not Orthogonal, another way to get l_shape
+  scored->found =
+      (scored->orthogonal ||
+       GetLShape(contour, bound, vertex, &l_shape, straightness)) &&
+      l_shape.position != (unsigned)-1;
+  return scored->found;
+}
+
+double DatamatrixLocator::ScoreCandidate(const PointSeq& points,
+                                         Scored* scored) {
+  /* how much the contour looks like a datamatrix, by the first checks of
+   * LocateCandidate only:
+   *   straightness of the 2 lines of L (1 if orthogonal),
+   *   aspect of the bound,
+   *   blank(dark) rate of the ring just outside the bound(quiet zone).
+   * 0: no L shape, LocateCandidate would drop it at once. a bright ring only
+   * ranks the contour last, the blank L is checked by LocateCandidate. */
+  const int kRingGap = 2;  // px, from the bound to the ring
+  // the blank factor of a fully bright ring
+  const double kMinBlank = 0.05;
+  double straightness = 1.0;
+  if (!FindLShape(points, scored, &straightness)) {
+    // nothing to locate from, do not keep it
+    scored->contour = Contour();
+    return 0.0;
+  }
+  const Rect bound = scored->contour.bound;
+
+  double aspect = bound.width < bound.height
+                      ? (double)bound.width / bound.height
+                      : (double)bound.height / bound.width;
+
+  const int x0 = bound.x - kRingGap, x1 = bound.x + bound.width + kRingGap;
+  const int y0 = bound.y - kRingGap, y1 = bound.y + bound.height + kRingGap;
+  int n_bright = bits_.CountRow(y0, x0, x1) + bits_.CountRow(y1, x0, x1) +
+                 bits_.CountCol(x0, y0, y1) + bits_.CountCol(x1, y0, y1);
+  double blank = 1.0 - (double)n_bright / (2 * (x1 - x0) + 2 * (y1 - y0));
+  blank = std::max(blank, kMinBlank);
+
+  return straightness * aspect * blank;
+}
+
 int DatamatrixLocator::LocateDatamatrix(const Mat& source,
                                         const ImageProcessor processor,
-                                        MatVec* datamatrixs) {
+                                        MatVec* datamatrixs,
+                                        vector<Rect>* bounds,
+                                        MatVec* homographies,
+                                        const vector<int>* indices) {
 #ifdef DEBUG_DM_LOC
   namedWindow("Locator", 1);
   Mat drawing(image_.size(), CV_8UC3);
   cvtColor(image_, drawing, COLOR_GRAY2RGB);  
 #endif
-  int contour_index = 0;
-  int n_good_matrix = 0;
-  for (PointSeq contour : contours_) {    
-    // the 4 vertex points in a contour
-    XPoint vertex[4];
-    // bounding rect
-    Rect bound = GetBoundingRect(contour, vertex);
-    // l_shape for each contour
-    LShape l_shape;
-    l_shape.position = -1;  // empty
-    l_shape.angle1 = l_shape.angle2 = 0.0;
-    l_shape.reversed = false;
-    // Check if is Orthogonal, meanwhile get l_shape if is, it is faster
-    if (!CheckOrthogonal(contour, bound, &l_shape)) {      
-      // if not Orthogonal, another way to get l_shape
-      if (!GetLShape(contour, bound, vertex, &l_shape)) continue;
-      if (!CalibrateLShape(contour, &l_shape)) continue;
-    }
-    if (l_shape.position == -1) continue;
-
-    CalibrateP0(&l_shape);
-    RedefineAnglePosition(&l_shape);
-    // check blank L and reset p1,p2 -> then p0
-    if (!CheckBlankL(&l_shape)) continue;
-    if (!SetPx(image_, 2, &l_shape)) continue;
-    PaddingLShape(image_, true, &l_shape);       
-    // transform 1 l_shape -> rectangle  
-    if (!EnlargeLShape(&l_shape)) continue;    
-    int image_size = source.cols > source.rows ? source.cols : source.rows;
-    Mat transformed_1 = Mat::zeros(Size(image_size, image_size), CV_8UC1);    
-    int image_w_h =
-        floor(Transform4LShape(source, l_shape, &transformed_1, -1) + 0.5); 
-    Mat binary_1 = transformed_1(Rect(0, 0, image_w_h, image_w_h)).clone();
-    ImageProcessor p = processor;
-    p.set_image(binary_1);
-    vector<PointSeq> no_use;
-    p.Process(&binary_1, &no_use);
-    // modify L shape
-    l_shape.p0.location = Point(0, image_w_h - 1);
-    l_shape.p1.location = Point(0, 0);
-    l_shape.p2.location = Point(image_w_h - 1, image_w_h - 1);
-    l_shape.angle1 = 90.0;
-    l_shape.angle2 = 0.0;
-    l_shape.reversed = 0;
-    if (!SetPx(binary_1, 5, &l_shape)) continue;
-    PaddingLShape(binary_1, false, &l_shape);
-
-    // transform again
-    Mat transformed_2(image_w_h, image_w_h, CV_8UC1);
-    Transform4LShape(transformed_1, l_shape, &transformed_2, image_w_h);
-    n_good_matrix++; // success!
-    datamatrixs->push_back(transformed_2);
-
-  }
+  const int n_contours =
+      indices != NULL ? (int)indices->size() : (int)contours_.size();
+  const bool want_homography = homographies != NULL;
+  int n_good_matrix = CollectCandidates(
+      n_contours,
+      [&](const int i, Candidate* candidate) {
+        return LocateCandidate(source, processor,
+                               indices != NULL ? (*indices)[i] : i,
+                               want_homography, candidate);
+      },
+      datamatrixs, bounds, homographies);
 #ifdef DEBUG_DM_LOC
   imshow("Locator", drawing);
   waitKey(0);
@@ -223,34 +597,325 @@ int DatamatrixLocator::LocateDatamatrix(const Mat& source,
   return n_good_matrix;
 }
 
-Rect DatamatrixLocator::GetBoundingRect(const PointSeq contour,
+int DatamatrixLocator::LocateLShapes(const Mat& source, const Mat& gray,
+                                     const ImageProcessor processor,
+                                     const vector<LShape>& l_shapes,
+                                     MatVec* datamatrixs, vector<Rect>* bounds,
+                                     MatVec* homographies,
+                                     const vector<int>* indices) {
+  /* there is no binarized image for these L shapes: the area around each one
+   * is binarized by its own(Otsu) threshold, the blank L and px are checked
+   * on it, then it goes on as a contour does. */
+  // px checked outside the L shape by CheckBlankL & SetPx
+  const int kMargin = 24;
+  const int n_shapes =
+      indices != NULL ? (int)indices->size() : (int)l_shapes.size();
+  const bool want_homography = homographies != NULL;
+  const Rect image_rect(0, 0, gray.cols, gray.rows);
+  return CollectCandidates(
+      n_shapes,
+      [&](const int i, Candidate* candidate) {
+        LShape l_shape = l_shapes[indices != NULL ? (*indices)[i] : i];
+        PointSeq corners = {l_shape.p0.location, l_shape.p1.location,
+                            l_shape.p2.location, l_shape.px.location};
+        Rect roi = boundingRect(corners);
+        roi = Rect(roi.x - kMargin, roi.y - kMargin, roi.width + 2 * kMargin,
+                   roi.height + 2 * kMargin) &
+              image_rect;
+        if (roi.width < 2 || roi.height < 2)
+          return Reject(REJECT_ENLARGE, candidate);
+        Mat binary;
+        threshold(gray(roi), binary, 0, 255,
+                  (processor.bin_reversed() ? THRESH_BINARY
+                                            : THRESH_BINARY_INV) |
+                      THRESH_OTSU);
+        BitImage bits(binary);
+        ShiftLShape(-roi.tl(), &l_shape);
+        const bool orthogonal = fmod(l_shape.angle1, 90.0) == 0.0 &&
+                                fmod(l_shape.angle2, 90.0) == 0.0;
+        return LocateLShape(source, processor, bits, roi.tl(), orthogonal,
+                            l_shape, want_homography, candidate);
+      },
+      datamatrixs, bounds, homographies);
+}
+
+int DatamatrixLocator::CollectCandidates(
+    const int n_candidates,
+    const std::function<bool(const int, Candidate*)>& locate,
+    MatVec* datamatrixs, vector<Rect>* bounds, MatVec* homographies) {
+  /* candidates are independent: each one is located into its own slot, the
+   * slots are merged in the order given so the output does not depend on how
+   * the candidates are shared among threads. */
+  vector<Candidate> slots(n_candidates);
+  stats_.candidates += n_candidates;
+  if (threads_ == 1 || n_candidates < 2) {
+    for (int i = 0; i < n_candidates; i++)
+      slots[i].good = locate(i, &slots[i]);
+  } else {
+    // one stripe per candidate, idle workers take the next one left
+    parallel_for_(Range(0, n_candidates), [&](const Range& range) {
+      for (int i = range.start; i < range.end; i++)
+        slots[i].good = locate(i, &slots[i]);
+    }, n_candidates);
+  }
+  int n_good_matrix = 0;
+  for (int i = 0; i < n_candidates; i++) {
+    if (!slots[i].good) {
+      stats_.Count(slots[i].reject);
+      continue;
+    }
+    n_good_matrix++;
+    if (bounds != NULL) bounds->push_back(slots[i].bound);
+    if (homographies != NULL)
+      homographies->push_back(slots[i].homography);
+    else
+      datamatrixs->push_back(slots[i].datamatrix);
+  }
+  return n_good_matrix;
+}
+
+bool DatamatrixLocator::LocateCandidate(const Mat& source,
+                                        const ImageProcessor& processor,
+                                        const int index,
+                                        const bool want_homography,
+                                        Candidate* candidate) {
+  // scored by ScoreContours already, or found here
+  Scored found;
+  const Scored* scored = &found;
+  if (index < (int)scored_.size())
+    scored = &scored_[index];
+  else
+    FindLShape(contours_[index], &found);
+  if (!scored->found) return Reject(REJECT_L_SHAPE, candidate);
+  const bool orthogonal = scored->orthogonal;
+  LShape l_shape = scored->l_shape;
+  if (!orthogonal && !CalibrateLShape(scored->contour, &l_shape))
+    return Reject(REJECT_CALIBRATE, candidate);
+  return LocateLShape(source, processor, bits_, Point(0, 0), orthogonal,
+                      l_shape, want_homography, candidate);
+}
+
+bool DatamatrixLocator::LocateLShape(const Mat& source,
+                                     const ImageProcessor& processor,
+                                     const BitImage& bits, const Point offset,
+                                     const bool orthogonal, LShape l_shape,
+                                     const bool want_homography,
+                                     Candidate* candidate) {
+  // margin(px) added to each side of the L shape before transforming
+  const int kEnlarge = 2;
+  // contours and image_ are found at 1/scale of the source resolution
+  const int scale = processor.pyramid_scale();
+  CalibrateP0(&l_shape);
+  RedefineAnglePosition(&l_shape);
+  // check blank L and reset p1,p2 -> then p0
+  if (!CheckBlankL(bits, &l_shape)) return Reject(REJECT_BLANK_L, candidate);
+  if (!SetPx(bits, 2, &l_shape)) return Reject(REJECT_PX, candidate);
+  PaddingLShape(bits, true, &l_shape);
+  // still horizontal/vertical: cropped from source, no transform at all
+  if (orthogonal && scale == 1 && !subpixel_ && lens_.empty()) {
+    // tight to the datamatrix, as PaddingLShape on the transformed image
+    LShape tight = l_shape;
+    PaddingLShape(bits, false, &tight);
+    ShiftLShape(offset, &tight);
+    if (CropOrthogonal(source, tight, want_homography, candidate)) return true;
+  }
+  ShiftLShape(offset, &l_shape);
+  // back to source resolution, the sampling below is done on source
+  if (scale > 1) ScaleLShape(scale, &l_shape);
+  // transform 1 l_shape -> rectangle
+  if (!EnlargeLShape(source, kEnlarge + scale / 2, &l_shape))
+    return Reject(REJECT_ENLARGE, candidate);
+  // most false candidates are dropped here, before the full warps
+  if (!CheckThumbnail(source, l_shape, processor.bin_reversed()))
+    return Reject(REJECT_THUMBNAIL, candidate);
+  PointSeq corners = {l_shape.p0.location, l_shape.p1.location,
+                      l_shape.p2.location, l_shape.px.location};
+  candidate->bound = boundingRect(corners);
+  // the output is as large as the datamatrix, not the source
+  Mat transformed_1, matrix_1;
+  int image_w_h = floor(
+      Transform4LShape(source, l_shape, &transformed_1, -1, &matrix_1) + 0.5);
+  Mat binary_1;
+  processor.Binarize(transformed_1, &binary_1);
+  BitImage bits_1(binary_1);
+  // modify L shape
+  l_shape.p0.location = Point(0, image_w_h - 1);
+  l_shape.p1.location = Point(0, 0);
+  l_shape.p2.location = Point(image_w_h - 1, image_w_h - 1);
+  l_shape.angle1 = 90.0;
+  l_shape.angle2 = 0.0;
+  l_shape.reversed = 0;
+  if (!SetPx(bits_1, 5, &l_shape))
+    return Reject(REJECT_PX_WARPED, candidate);
+  PaddingLShape(bits_1, false, &l_shape);
+
+  if (subpixel_) {
+    // back to source, where the edges are fitted in subpixel
+    vector<Point2f> refined = {Point2f(l_shape.p1.location),
+                               Point2f(l_shape.p0.location),
+                               Point2f(l_shape.p2.location),
+                               Point2f(l_shape.px.location)};
+    perspectiveTransform(refined, refined, matrix_1.inv());
+    // the edges are fitted on the raw source
+    for (Point2f& corner : refined)
+      corner = Point2f(lens_.Distort(Point2d(corner)));
+    if (RefineCorners(source, processor.bin_reversed(), &refined)) {
+      Mat matrix;
+      Transform(source, refined.data(), image_w_h,
+                want_homography ? NULL : &candidate->datamatrix, &matrix);
+      if (want_homography) {
+        Mat unit = Mat::eye(3, 3, CV_64F);
+        unit.at<double>(0, 0) = unit.at<double>(1, 1) = image_w_h;
+        candidate->homography = matrix.inv() * unit;
+      }
+      return true;
+    }
+  }
+  if (want_homography) {
+    // no more warping: compose both transforms, from the unit square of
+    // the datamatrix back to source
+    Mat matrix_2;
+    Transform4LShape(transformed_1, l_shape, NULL, image_w_h, &matrix_2,
+                     false);
+    Mat unit = Mat::eye(3, 3, CV_64F);
+    unit.at<double>(0, 0) = unit.at<double>(1, 1) = image_w_h;
+    candidate->homography = (matrix_2 * matrix_1).inv() * unit;
+    return true;
+  }
+  // transform again, transformed_1 is undistorted already
+  Transform4LShape(transformed_1, l_shape, &candidate->datamatrix, image_w_h,
+                   NULL, false);
+  return true;  // success!
+}
+
+bool DatamatrixLocator::CropOrthogonal(const Mat& source,
+                                       const LShape& l_shape,
+                                       const bool want_homography,
+                                       Candidate* candidate) {
+  /* the datamatrix is cut out of source as it is, then turned by transpose
+   * and flip, so that p1 is at top-left and p0 at left-bottom, as
+   * Transform4LShape outputs. a rectangle is resized to a square. */
+  const int kTolerance = 2;  // px, of a corner to the bound vertex
+  const Point corners[] = {l_shape.p1.location, l_shape.p0.location,
+                           l_shape.p2.location, l_shape.px.location};
+  Rect bound = boundingRect(PointSeq(corners, corners + 4));
+  if (bound.width < 2 || bound.height < 2) return false;
+  if ((bound & Rect(0, 0, source.cols, source.rows)) != bound) return false;
+
+  // quadrant(0/1, 0/1) of each corner in bound, all 4 must differ
+  int qx[4], qy[4], used = 0;
+  for (int i = 0; i < 4; i++) {
+    qx[i] = corners[i].x - bound.x > bound.width / 2 ? 1 : 0;
+    qy[i] = corners[i].y - bound.y > bound.height / 2 ? 1 : 0;
+    int vx = bound.x + qx[i] * (bound.width - 1);
+    int vy = bound.y + qy[i] * (bound.height - 1);
+    if (abs(corners[i].x - vx) > kTolerance ||
+        abs(corners[i].y - vy) > kTolerance)
+      return false;
+    used |= 1 << (qy[i] * 2 + qx[i]);
+  }
+  if (used != 0xF) return false;
+
+  // transpose, then flip x, flip y: p1 -> (0, 0), p0 -> (0, 1)
+  int op;
+  bool found = false;
+  for (op = 0; op < 8 && !found; op++) {
+    int x1 = qx[0], y1 = qy[0], x0 = qx[1], y0 = qy[1];
+    if (op & 1) std::swap(x1, y1), std::swap(x0, y0);
+    if (op & 2) x1 = 1 - x1, x0 = 1 - x0;
+    if (op & 4) y1 = 1 - y1, y0 = 1 - y0;
+    found = x1 == 0 && y1 == 0 && x0 == 0 && y0 == 1;
+  }
+  if (!found) return false;
+  op--;
+
+  const int size = std::max(bound.width, bound.height);
+  candidate->bound = bound;
+  if (want_homography) {
+    // from the unit square to the pixel edges of bound
+    Point2f vertex[4];
+    for (int i = 0; i < 4; i++)
+      vertex[i] = Point2f(bound.x - 0.5f + qx[i] * bound.width,
+                          bound.y - 0.5f + qy[i] * bound.height);
+    Mat matrix;
+    Transform(source, vertex, size, NULL, &matrix);
+    Mat unit = Mat::eye(3, 3, CV_64F);
+    unit.at<double>(0, 0) = unit.at<double>(1, 1) = size;
+    candidate->homography = matrix.inv() * unit;
+    return true;
+  }
+
+  Mat turned = source(bound).clone();
+  if (op & 1) {
+    Mat transposed;
+    transpose(turned, transposed);
+    turned = transposed;
+  }
+  if (op & 6) {
+    // flip code: 1 around y axis, 0 around x axis, -1 both
+    Mat flipped;
+    flip(turned, flipped, (op & 6) == 6 ? -1 : ((op & 2) ? 1 : 0));
+    turned = flipped;
+  }
+  if (turned.cols != size || turned.rows != size)
+    resize(turned, candidate->datamatrix, Size(size, size));
+  else
+    candidate->datamatrix = turned;
+  return true;
+}
+
+bool DatamatrixLocator::CheckThumbnail(const Mat& source,
+                                       const LShape& l_shape,
+                                       const bool reversed) {
+  /* warp the L shape to a small square, then look for both timing sides as
+   * DatamatrixReader::GetCodeSize does: alternating elements of an even count
+   * on the top and the right side. a side passes when one of the tried rows
+   * counts an even number of elements; at thumbnail scale a pair of elements
+   * may merge in some rows and give an odd count, so those rows are skipped
+   * instead of failing the side. if the elements are too small to be told
+   * apart, the square is doubled, up to the size of the full warp. */
+  const int kThumbnail = 64;
+  // rows(columns) tried from each side, the blank border is included
+  const int kTryTimes = 8;
+  // px, the shortest run of an element which can be told in the square
+  const int kMinRun = 3;
+  const double full_w_h = Transform4LShape(source, l_shape, NULL);
+  for (int side = kThumbnail; side < full_w_h; side *= 2) {
+    Mat thumbnail, binary;
+    Transform4LShape(source, l_shape, &thumbnail, side);
+    threshold(thumbnail, binary, 0, 255,
+              (reversed ? THRESH_BINARY : THRESH_BINARY_INV) | THRESH_OTSU);
+    BitImage bits(binary);
+    vector<uchar> line(side);
+    int size_x = -1, size_y = -1, max_runs = 0;
+    for (int j = 0; j < kTryTimes; j++) {
+      LineSampler(Point(0, j), 0.0, -1).Sample(bits, side, line.data());
+      int size = CountDashes(line);
+      if (size % 2 == 0) size_x = std::max(size_x, size);
+      int runs = 1;
+      for (int i = 1; i < side; i++) runs += line[i] != line[i - 1];
+      max_runs = std::max(max_runs, runs);
+      LineSampler(Point(side - j - 1, side - 1), 90.0, -1)
+          .Sample(bits, side, line.data());
+      size = CountDashes(line);
+      if (size % 2 == 0) size_y = std::max(size_y, size);
+    }
+    // an even count of elements, at least 10 horizontal, 8 vertical
+    if (size_x >= 10 && size_y >= 8) return true;
+    if (max_runs * kMinRun <= side) return false;
+  }
+  return true;
+}
+
+Rect DatamatrixLocator::GetBoundingRect(const Contour& contour,
                                         XPoint* vertex) {
   /* return the boundary of contour
    * find 4 points in the contour which are the closest to bound's vertex,
    * output them to vertex */
-  Rect bound = boundingRect(contour);
-  // the 4 vertex points of bound
-  Point bound_vertex[4];
-  bound_vertex[0] = Point(bound.x, bound.y),
-  bound_vertex[1] = Point(bound.x, bound.y + bound.height),
-  bound_vertex[2] = Point(bound.x + bound.width, bound.y + bound.height),
-  bound_vertex[3] = Point(bound.x + bound.width, bound.y);
-  // get the closest point(of the contour) to each bound vertex
-  int distance[] = {1000000, 1000000, 1000000, 1000000};
-  size_contour i, j;
-  for (i = 0; i < (size_contour)contour.size(); i++) {
-    Point p = contour.at(i);
-    int x = p.x, y = p.y;
-    for (j = 0; j < 4; j++) {
-      int d = GetDistancePow(p, bound_vertex[j]);
-      if (d < distance[j]) {
-        distance[j] = d;
-        vertex[j].location.x = x;
-        vertex[j].location.y = y;
-        vertex[j].index = i;
-      }
-    }
-  }
+  const Rect bound = contour.bound;
+  // the closest point(of the contour) to each bound vertex
+  int j;
+  for (j = 0; j < 4; j++) vertex[j] = contour.nearest[j];
   // check rotation
   int top = 10000, right = -1, bottom = -1, left = 10000;
   for (j = 0; j < 4; j++) {
@@ -268,60 +933,22 @@ Rect DatamatrixLocator::GetBoundingRect(const PointSeq contour,
   if (rotateRate < 0.75) {
     // if the rotation exceeds a certain degree, reassign vertex with the
     // most top\left\bottom\right points in the contour
-    // get the most left,top,bottom,right point in the contour
-    int top = 10000, right = -1, bottom = -1, left = 10000;
-    for (i = 0; i < (size_contour)contour.size(); i++) {
-      Point p = contour.at(i);
-      int x = p.x, y = p.y;
-
-      if (y < top) {
-        top = y;
-        vertex[0].location.x = x;
-        vertex[0].location.y = y;
-        vertex[0].index = i;
-      }
-      if (x < left) {
-        left = x;
-        vertex[1].location.x = x;
-        vertex[1].location.y = y;
-        vertex[1].index = i;
-      }
-      if (y > bottom) {
-        bottom = y;
-        vertex[2].location.x = x;
-        vertex[2].location.y = y;
-        vertex[2].index = i;
-      }
-      if (x > right) {
-        right = x;
-        vertex[3].location.x = x;
-        vertex[3].location.y = y;
-        vertex[3].index = i;
-      }
-    }
+    for (j = 0; j < 4; j++) vertex[j] = contour.extreme[j];
   }
 
   return bound;
 }
 
-bool DatamatrixLocator::CheckOrthogonal(const PointSeq contour,
-                                        const Rect bound, LShape* l_shape) {
+bool DatamatrixLocator::CheckOrthogonal(const Contour& contour,
+                                        LShape* l_shape) {
   /* if the contour is orthogonal(horiz/verti), get the "L" shape
    *  match every contour point to bound, make sure most(kOverlayRate) of the
-   *  points not too far from bound(kGap).
+   *  points not too far from bound(Contour::kSideGap).
    *  notice: bound is orthogonal.*/
-  const int kGap = 4;
   const double kOverlayRate = 0.7;
-  int counters[4] = {0};
+  const Rect bound = contour.bound;
+  const int* counters = contour.side_counts;
   size_contour i;
-  for (i = 0; i < (size_contour)contour.size(); i++) {
-    Point p = contour.at(i);
-    int x = p.x, y = p.y;
-    if (y - bound.y < kGap) counters[0]++;                 // top
-    if (x - bound.x < kGap) counters[1]++;                 // left
-    if (bound.y + bound.height - y < kGap) counters[2]++;  // bottom
-    if (bound.x + bound.width - x < kGap) counters[3]++;   // right
-  }
 
   // 2 max lines
   int max1 = 0;
@@ -389,48 +1016,28 @@ bool DatamatrixLocator::CheckOrthogonal(const PointSeq contour,
     l_shape->angle2 = 0.0;
   }
 
-  // get the most closed point(in contour) to each conner point(90L), and that
-  // would be the new p1,p2
-  int min1 = 10000, min2 = 10000;
-  size_contour idx1=0, idx2=0;
-  int x1 = l_shape->p1.location.x;
-  int y1 = l_shape->p1.location.y;
-  int x2 = l_shape->p2.location.x;
-  int y2 = l_shape->p2.location.y;
-
-  Point p1min, p2min;
-  for (i = 0; i < (size_contour)contour.size(); i++) {
-    Point p = contour.at(i);
-    int x = p.x, y = p.y;
-    int d = (x - x1) * (x - x1) + (y - y1) * (y - y1);
-    if (d < min1) {
-      p1min = p;
-      idx1 = i;
-      min1 = d;
-    }
-
-    d = (x - x2) * (x - x2) + (y - y2) * (y - y2);
-    if (d < min2) {
-      p2min = p;
-      idx2 = i;
-      min2 = d;
-    }
-  }
-  l_shape->p1.location = p1min;
-  l_shape->p1.index = idx1;
-  l_shape->p2.location = p2min;
-  l_shape->p2.index = idx2;
+  // the most closed point(in contour) to each conner point(90L) would be
+  // the new p1,p2. vertexes of bound: 0:top-left, 1:left-bottom,
+  // 2:bottom-right, 3:right-top
+  const int kNearestP1[] = {3, 0, 1, 2};
+  const int kNearestP2[] = {1, 2, 3, 0};
+  // 2 opposite sides: no L shape, left empty for the caller
+  if (l_shape->position > 3) return true;
+  l_shape->p1 = contour.nearest[kNearestP1[l_shape->position]];
+  l_shape->p2 = contour.nearest[kNearestP2[l_shape->position]];
 
   return true;
 }
 
-bool DatamatrixLocator::GetLShape(const PointSeq contour, const Rect bound,
-                                  const XPoint* vertex, LShape* l_shape) {
+bool DatamatrixLocator::GetLShape(const Contour& contour, const Rect bound,
+                                  const XPoint* vertex, LShape* l_shape,
+                                  double* straightness) {
   /*  if the contour is not orthogonal, get the "L" shape
    *  by determining which vertexes fit 2 good lines in the contour.*/
   const double kLineError = 0.8 * 0.8;  // error^2
   const double kAspectError = 0.04;     // 1:4, so 0.25*0.25=0.0625
-  const int kMinStep = 1600;            // (4*10)^2, 4px:min datamatrix element
+  // (min_module*10)^2, 10 elements at least on a side
+  const int kMinStep = (min_module_ * 10) * (min_module_ * 10);
   int line_length[4];
   double rates[4] = {0.0};
 
@@ -445,10 +1052,11 @@ bool DatamatrixLocator::GetLShape(const PointSeq contour, const Rect bound,
                      (vertex[i].location.y - vertex[next].location.y) *
                          (vertex[i].location.y - vertex[next].location.y);
 
-    size_contour index0 = vertex[i].index;
-    size_contour index1 = vertex[next].index;
+    // steps are counted on the points before simplified
+    size_contour index0 = contour.Origin(vertex[i].index);
+    size_contour index1 = contour.Origin(vertex[next].index);
     size_contour index_diff = index1 - index0;
-    if (index1 < index0) index_diff = index1 + contour.size() - index0 + 1;
+    if (index1 < index0) index_diff = index1 + contour.total - index0 + 1;
     size_contour steps_sqr = index_diff * index_diff;
     // i=0:top-left,1:left-bottom,2:bottom-right,3:right-top
     rates[i] = (double)line_length[i] / steps_sqr;
@@ -475,6 +1083,7 @@ bool DatamatrixLocator::GetLShape(const PointSeq contour, const Rect bound,
     }
   }
   if (max2 < kLineError) return false;
+  if (straightness != NULL) *straightness = std::min(max2, 1.0);
   // check if L1 is too much longer than L2
   // notice: lineLength is squared
   double aspect = line_length[maxIdx2] < line_length[maxIdx1]
@@ -520,7 +1129,7 @@ bool DatamatrixLocator::GetLShape(const PointSeq contour, const Rect bound,
   return true;
 }
 
-bool DatamatrixLocator::CalibrateLShape(const PointSeq contour,
+bool DatamatrixLocator::CalibrateLShape(const Contour& contour,
                                         LShape* l_shape) {
   // adjust angle1,angle2,p1,p2
   XPoint pHome1 = l_shape->p0, pHome2 = l_shape->p0;
@@ -535,58 +1144,91 @@ bool DatamatrixLocator::CalibrateLShape(const PointSeq contour,
   return false;
 }
 
-bool DatamatrixLocator::CalibrateAngle(const PointSeq contour, const XPoint p0,
+bool DatamatrixLocator::CalibrateAngle(const Contour& contour, const XPoint p0,
                                        const int direction, XPoint* p,
                                        double* angle) {
   /* get a better angle for lShape.angle1,lShape.angle2
    * set several sample points in the path from p0 to p(p1/p2), calc every angle
    * formed by p-sample and every point of the path. the angle value that
-   * appears the most times wins, and the p-sample wins. */
+   * appears the most times wins, and the p-sample wins.
+   * the samples are placed on the points before simplified: a straight side
+   * may be a single edge of the polygon, with no vertex between p and p0. */
   const int kSmapleSize = 6;
   size_contour kTotal = contour.size();
   XPoint samples[kSmapleSize];
-  size_contour i, idx, path;
+  size_contour i, idx;
   // hough(count) for each sample by every angle
   int hough[kSmapleSize * 180];
   for (i = 0; i < kSmapleSize * 180; i++) hough[i] = 0;
-  path = direction * ((size_contour)p0.index - (size_contour)p->index);
-  if (path < 0) path = kTotal + path;
-  const size_contour kMinHough = path / 4;
-
-  // set sample points
-  size_contour interval = path / (kSmapleSize + 1);
+  // votes are weighted by the points each vertex stands for
+  size_contour path_points = direction * (contour.Origin(p0.index) -
+                                          contour.Origin(p->index));
+  if (path_points < 0) path_points = contour.total + path_points;
+  const size_contour kMinHough = path_points / 4;
+
+  // set sample points, index: of the points before simplified
+  size_contour interval = path_points / (kSmapleSize + 1);
   for (i = 0; i < kSmapleSize; ++i) {
-    idx = p->index + direction * interval * (i + 1);
-    idx += idx < 0 ? kTotal : 0;
-    idx -= idx >= kTotal ? kTotal : 0;
-    Point sample = contour.at(idx);
+    idx = contour.Origin(p->index) + direction * interval * (i + 1);
+    idx += idx < 0 ? contour.total : 0;
+    idx -= idx >= contour.total ? contour.total : 0;
+    Point sample = contour.Raw(idx);
     samples[i].location = sample;
     samples[i].index = idx;
   }
-  // set angle formed by every point(of the path) to each sample points
-  Point current_point;
+  // collect the path(p -> p0) into plain arrays first. a simplified path
+  // keeps p0, the end of its last edge, and each vertex weighs the points
+  // from the previous one
+  const bool simplified = !contour.origin.empty();
+  vector<int> path_x, path_y;
+  vector<size_contour> path_idx;
+  vector<int> path_weight;
   idx = p->index;
-  int current_angle;
-  int current_hough = 0, max_hough = 0, max_angle = -1;
-  size_contour max_sample = -1;
+  size_contour last_origin = -1;
   while (1) {
     idx += idx < 0 ? kTotal : 0;
     idx -= idx >= kTotal ? kTotal : 0;
-    if (idx == p0.index + 1) break;
-    if (idx == p0.index - 1) break;
-
-    current_point = contour.at(idx);
+    if (!simplified && (idx == p0.index + 1 || idx == p0.index - 1)) break;
+    path_x.push_back(contour.x[idx]);
+    path_y.push_back(contour.y[idx]);
+    path_idx.push_back(contour.Origin(idx));
+    size_contour steps = 1;
+    if (simplified && last_origin != -1) {
+      steps = direction * (contour.origin[idx] - last_origin);
+      if (steps < 0) steps += contour.total;
+    }
+    path_weight.push_back((int)steps);
+    if (simplified) {
+      if (idx == p0.index) break;
+      last_origin = contour.origin[idx];
+    }
+    idx = idx + direction;
+  }
+  const size_t n_path = path_idx.size();
+  // set angle formed by every point(of the path) to each sample points
+  vector<uchar> angles(n_path * kSmapleSize);
+  for (i = 0; i < kSmapleSize; i++) {
+    const Point sample = samples[i].location;
+    uchar* sample_angles = angles.data() + n_path * i;
+    for (size_t k = 0; k < n_path; k++)
+      sample_angles[k] =
+          (uchar)GetAngle(sample, Point(path_x[k], path_y[k]));
+  }
+  // vote in the order of the path, the first angle to reach the max wins
+  int current_angle;
+  int current_hough = 0, max_hough = 0, max_angle = -1;
+  size_contour max_sample = -1;
+  for (size_t k = 0; k < n_path; k++) {
     for (i = 0; i < kSmapleSize; i++) {
-      if (samples[i].index == idx) continue;
-      current_angle = GetAngle(samples[i].location, current_point);
-      current_hough = ++hough[i * 180 + current_angle];
+      if (samples[i].index == path_idx[k]) continue;
+      current_angle = angles[n_path * i + k];
+      current_hough = hough[i * 180 + current_angle] += path_weight[k];
       if (current_hough > max_hough) {
         max_hough = current_hough;
         max_angle = current_angle;
         max_sample = i;
       }
     }
-    idx = idx + direction;
   }
   if (max_hough < kMinHough) return false;
   // calibate
@@ -601,36 +1243,40 @@ bool DatamatrixLocator::CalibrateAngle(const PointSeq contour, const XPoint p0,
   return true;
 }
 
-void DatamatrixLocator::CalibrateP1P2(const PointSeq contour,
+void DatamatrixLocator::CalibrateP1P2(const Contour& contour,
                                       const XPoint best_point, const int angle,
                                       const int direction, const int orient,
                                       XPoint* p) {
   /*  ajust p1/p2. move p1/p2 forward and backward, until angle formed by it
-   *   and best_point reach the error limit
+   *   and best_point reach the error limit. it walks the points before
+   *   simplified, a vertex of the polygon may be a whole side away
    */
   const double kErrorLimit = 2.0;
-  const size_contour kTotal = contour.size();
+  const size_contour kTotal = contour.total;
+  const bool simplified = !contour.origin.empty();
   Point current_point;
   XPoint final = *p;
-  size_contour idx = p->index + direction;
+  size_contour idx = contour.Origin(p->index) + direction;
   int counter = 0;
   while (1) {
     if (idx == -1) idx = kTotal - 1;
-    if (idx == kTotal + 1) idx = 0;
+    if (idx == kTotal) idx = 0;
     if (counter > 30) break;
-    current_point = contour.at(idx);
+    current_point = contour.Raw(idx);
     double diff = fabs(GetAngleF(best_point.location, current_point) - angle);
+    // a point between 2 vertexes is not in the contour(-1)
+    const size_contour index = simplified ? -1 : idx;
     if (orient == -1) {  // further to home
       if (diff > kErrorLimit) {
         break;
       } else {
         final.location = current_point;
-        final.index = idx;
+        final.index = index;
       }
     } else if (orient == +1) {  // closer to home
       if (diff < kErrorLimit) {
         final.location = current_point;
-        final.index = idx;
+        final.index = index;
         break;
       }
     }
@@ -710,7 +1356,7 @@ void DatamatrixLocator::RedefineAnglePosition(LShape* l_shape) {
   }
 }
 
-bool DatamatrixLocator::CheckBlankL(LShape* l_shape) {
+bool DatamatrixLocator::CheckBlankL(const BitImage& image, LShape* l_shape) {
   const int kSteps = 10;
   const double kBrightRate = 0.05;
   Point p0 = l_shape->p0.location;
@@ -723,14 +1369,15 @@ bool DatamatrixLocator::CheckBlankL(LShape* l_shape) {
   double angle90_p1 = l_shape->angle1 + 90.0;
   double angle90_p2 = l_shape->angle2 - 90.0;
   int move1 = 0, move2 = 0;
+  const LineSampler out_p1(p1, angle90_p1, -1), out_p2(p2, angle90_p2, -1);
 
   // must get a blank L(border:1px) in kSteps pixels
   for (i = 0; i < kSteps; i++) {
-    p1 = MovePixel(p1, angle90_p1, 1, -1);
+    p1 = out_p1.Move(p1, 1);
     move1++;
     // track
     double rate =
-        GetBrightRateInALine(image_, p1, l_shape->angle1, kLength1 + i, +1);
+        GetBrightRateInALine(image, p1, l_shape->angle1, kLength1 + i, +1);
     if (rate < kBrightRate) break;
     
   }
@@ -740,11 +1387,11 @@ bool DatamatrixLocator::CheckBlankL(LShape* l_shape) {
  //  p1 = MovePixel(l_shape->p1.location, angle90_p1, move1, -1);
 
   for (i = 0; i < kSteps; i++) {  // must get a blank L(border:1px) in ? pixels
-    p2 = MovePixel(p2, angle90_p2, 1, -1);
+    p2 = out_p2.Move(p2, 1);
     move2++;
     // track
     double rate =
-        GetBrightRateInALine(image_, p2, l_shape->angle2, kLength2 + i, +1);
+        GetBrightRateInALine(image, p2, l_shape->angle2, kLength2 + i, +1);
     if (rate < kBrightRate) break;
   }
   if (move2 == kSteps)
@@ -758,13 +1405,11 @@ bool DatamatrixLocator::CheckBlankL(LShape* l_shape) {
   return true;
 }
 
-bool DatamatrixLocator::SetPx(const Mat& image, const int padding,
+bool DatamatrixLocator::SetPx(const BitImage& image, const int padding,
                               LShape* l_shape) {
   /* set px of L shape
    */
   const int kTrackLimit = 15; // pixel
-  const double kBrightRate = 0.05;
-  const int kRotateLimit = 15;  // degree
   double angleX1, angleX2;
 
 
@@ -778,7 +1423,6 @@ bool DatamatrixLocator::SetPx(const Mat& image, const int padding,
   int j;
 
   // track 90  DEGREE_ALLOW degree line: p1,p2
-  int rotate;
   double newAngle;
   Point ptrack, pTemp, pTemp1;
   double goodAngles[kTrackLimit] = {-1.0};
@@ -787,19 +1431,15 @@ bool DatamatrixLocator::SetPx(const Mat& image, const int padding,
 
   // p1
   p1 = MovePixel(p1, l_shape->angle1, padding, +1);
+  const LineSampler along_1(p1, l_shape->angle1, -1);
   for (j = 0; j < kTrackLimit; j++) {
     // extend out
-    pTemp = MovePixel(p1, l_shape->angle1, j, -1);
-    pTemp1 = MovePixel(p1, l_shape->angle1, j + 2, -1);
-    for (rotate = -kRotateLimit; rotate <= kRotateLimit; rotate++) {
-      newAngle = l_shape->angle1 - 90.0 + (double)rotate;
-      L = (int)floor(L2 / cos(CV_PI * rotate / 180.0) + 0.5);
-      double rate = GetBrightRateInALine(image, pTemp1, newAngle, L, -1);
-      if (rate < kBrightRate) {
-        goodAngles[j] = newAngle;
-        rates[j] = GetDashNumberBright(image, pTemp, newAngle, L, -1);
-        break;
-      }
+    pTemp = along_1.At(j);
+    pTemp1 = along_1.At(j + 2);
+    if (SearchBlankLine(image, pTemp1, l_shape->angle1 - 90.0, +1, L2,
+                        &newAngle, &L)) {
+      goodAngles[j] = newAngle;
+      rates[j] = GetDashNumberBright(image, pTemp, newAngle, L, -1);
     }
   }
   for (j = 0; j < kTrackLimit; j++) {
@@ -809,7 +1449,7 @@ bool DatamatrixLocator::SetPx(const Mat& image, const int padding,
     }
   }
   if (maxRate < 3) return false;
-  l_shape->p1.location = MovePixel(p1, l_shape->angle1, maxIdx + 1, -1);
+  l_shape->p1.location = along_1.At(maxIdx + 1);
   angleX1 = goodAngles[maxIdx];
 
   // p2
@@ -819,19 +1459,15 @@ bool DatamatrixLocator::SetPx(const Mat& image, const int padding,
   }
   maxRate = 0;
   p2 = MovePixel(p2, l_shape->angle2, padding, +1);
+  const LineSampler along_2(p2, l_shape->angle2, -1);
   for (j = 0; j < kTrackLimit; j++) {
     // extend out
-    pTemp = MovePixel(p2, l_shape->angle2, j, -1);
-    pTemp1 = MovePixel(p2, l_shape->angle2, j + 2, -1);
-    for (rotate = kRotateLimit; rotate >= -kRotateLimit; rotate--) {
-      newAngle = l_shape->angle2 + 90.0 + (double)rotate;
-      L = (int)floor(L1 / cos(CV_PI * rotate / 180.0) + 0.5);
-      double rate = GetBrightRateInALine(image, pTemp1, newAngle, L, -1);
-      if (rate < kBrightRate) {
-        goodAngles[j] = newAngle;
-        rates[j] = GetDashNumberBright(image, pTemp, newAngle, L, -1);
-        break;
-      }
+    pTemp = along_2.At(j);
+    pTemp1 = along_2.At(j + 2);
+    if (SearchBlankLine(image, pTemp1, l_shape->angle2 + 90.0, -1, L1,
+                        &newAngle, &L)) {
+      goodAngles[j] = newAngle;
+      rates[j] = GetDashNumberBright(image, pTemp, newAngle, L, -1);
     }
   }
   for (j = 0; j < kTrackLimit; j++) {
@@ -841,7 +1477,7 @@ bool DatamatrixLocator::SetPx(const Mat& image, const int padding,
     }
   }
   if (maxRate < 3) return false;
-  l_shape->p2.location = MovePixel(p2, l_shape->angle2, maxIdx + 1, -1);
+  l_shape->p2.location = along_2.At(maxIdx + 1);
   angleX2 = goodAngles[maxIdx];
 
 
@@ -858,7 +1494,29 @@ bool DatamatrixLocator::SetPx(const Mat& image, const int padding,
   return true;
 }
 
-void DatamatrixLocator::PaddingLShape(const Mat& image, const bool padding_back,
+bool DatamatrixLocator::SearchBlankLine(const BitImage& image, const Point p,
+                                        const double base_angle,
+                                        const int order, const double length,
+                                        double* angle, int* L) {
+  /* the first blank rotation in the given order, exactly as the sweep of
+   * 1 degree: every rotation before it must be tried, so no degree is
+   * skipped. instead each line stops counting once it can not be blank,
+   * a line across the datamatrix stops after a few pixels. */
+  const double kBrightRate = 0.05;
+  const int kRotateLimit = 15;  // degree
+  for (int k = 0; k <= 2 * kRotateLimit; k++) {
+    int rotate = order * (k - kRotateLimit);
+    *angle = base_angle + (double)rotate;
+    *L = (int)floor(length / cos(CV_PI * rotate / 180.0) + 0.5);
+    if (GetBrightRateInALine(image, p, *angle, *L, -1, kBrightRate) <
+        kBrightRate)
+      return true;
+  }
+  return false;
+}
+
+void DatamatrixLocator::PaddingLShape(const BitImage& image,
+                                      const bool padding_back,
                                       LShape* l_shape) {
   /* padding until the num of bright dots outside L shape is larger( >60% )*/
   const double kMinBrightRate = 0.6;
@@ -872,32 +1530,56 @@ void DatamatrixLocator::PaddingLShape(const Mat& image, const bool padding_back,
   int i;
   double angle90_p1 = l_shape->angle1 + 90.0;
   double angle90_p2 = l_shape->angle2 - 90.0;
-  Point track;
+  const LineSampler out_p1(p1, angle90_p1, +1), out_p2(p2, angle90_p2, +1);
 
   for (i = 0; i < kTryTimes; i++) {
     double rate =
         GetBrightRateInALine(image, p1, l_shape->angle1, kLenght1 + i, +1);
     if (rate >= kMinBrightRate)break;
     else
-      p1 = MovePixel(p1, angle90_p1, 1, +1);
+      p1 = out_p1.Move(p1, 1);
   }
-  if (padding_back) p1 = MovePixel(p1, angle90_p1, 1, -1);
+  if (padding_back) p1 = out_p1.Move(p1, -1);
   for (i = 0; i < kTryTimes; i++) {
     double rate =
         GetBrightRateInALine(image, p2, l_shape->angle2, kLenght2 + i, +1);
     if (rate >= kMinBrightRate)break;
     else
-      p2 = MovePixel(p2, angle90_p2, 1, +1);
+      p2 = out_p2.Move(p2, 1);
   }
-  if (padding_back) p2 = MovePixel(p2, angle90_p2, 1, -1);
+  if (padding_back) p2 = out_p2.Move(p2, -1);
 
   l_shape->p1.location = p1;
   l_shape->p2.location = p2;
   CalibrateP0(l_shape);
 }
 
-bool DatamatrixLocator::EnlargeLShape(LShape* l_shape) {
-  const int kSize = 2;
+bool DatamatrixLocator::Reject(const RejectReason reason,
+                               Candidate* candidate) {
+  candidate->reject = reason;
+  return false;
+}
+
+void DatamatrixLocator::ShiftLShape(const Point offset, LShape* l_shape) {
+  if (offset == Point(0, 0)) return;
+  l_shape->p0.location += offset;
+  l_shape->p1.location += offset;
+  l_shape->p2.location += offset;
+  l_shape->px.location += offset;
+}
+
+void DatamatrixLocator::ScaleLShape(const int scale, LShape* l_shape) {
+  /* map the vertexes to the center of the pixels they are shrunk from */
+  const int kOffset = (scale - 1) / 2;
+  XPoint* vertex[] = {&l_shape->p0, &l_shape->p1, &l_shape->p2, &l_shape->px};
+  for (int i = 0; i < 4; i++) {
+    vertex[i]->location.x = vertex[i]->location.x * scale + kOffset;
+    vertex[i]->location.y = vertex[i]->location.y * scale + kOffset;
+  }
+}
+
+bool DatamatrixLocator::EnlargeLShape(const Mat& image, const int kSize,
+                                      LShape* l_shape) {
   Point corners[4];
   corners[0] = l_shape->p1.location;
   corners[1] = l_shape->p0.location;
@@ -947,8 +1629,8 @@ bool DatamatrixLocator::EnlargeLShape(LShape* l_shape) {
       break;
   }
   for (int i = 0; i < 4; i++) {
-    if (corners[i].x < 0 || corners[i].x >= image_.cols) return false;
-    if (corners[i].y < 0 || corners[i].y >= image_.rows) return false;
+    if (corners[i].x < 0 || corners[i].x >= image.cols) return false;
+    if (corners[i].y < 0 || corners[i].y >= image.rows) return false;
   }
   l_shape->p1.location = corners[0];
   l_shape->p0.location = corners[1];
@@ -957,8 +1639,90 @@ bool DatamatrixLocator::EnlargeLShape(LShape* l_shape) {
   return true;
 }
 
+bool DatamatrixLocator::RefineCorners(const Mat& gray, const bool reversed,
+                                      vector<Point2f>* corners) {
+  /* fit each side by least squares to the edge points found across it, then
+   * intersect the sides. an edge point is the subpixel peak of the gray step
+   * from the datamatrix(dark unless reversed) to the blank border outside.
+   * on the timing sides, where half of the elements are bright, the points
+   * found on the next edge inside are dropped by fitting twice. */
+  const int kSearch = 3;         // px, across the side, each direction
+  const double kMinStep = 20.0;  // gray level
+  const double kMaxShift = kSearch + 1.0;
+  const int kMinPoints = 8;
+  vector<Point2f>& c = *corners;
+  Point2f center = (c[0] + c[1] + c[2] + c[3]) * 0.25f;
+
+  Vec4f lines[4];
+  for (int side = 0; side < 4; side++) {
+    Point2f a = c[side], b = c[(side + 1) % 4];
+    Point2f along = b - a;
+    double length = sqrt(along.dot(along));
+    if (length < kMinPoints) return false;
+    Point2f normal(-along.y / length, along.x / length);
+    // outward
+    if (normal.dot((a + b) * 0.5f - center) < 0) normal = -normal;
+
+    int n_samples = std::max((int)(length / 2), kMinPoints);
+    if (n_samples > 64) n_samples = 64;
+    vector<Point2f> edges;
+    for (int i = 0; i < n_samples; i++) {
+      Point2f s = a + along * (float)(0.1 + 0.8 * (i + 0.5) / n_samples);
+      // step at t: gray outside - gray inside, the datamatrix is dark
+      double steps[2 * kSearch + 1];
+      for (int t = -kSearch; t <= kSearch; t++) {
+        Point2f q = s + normal * (float)t;
+        double out = GetGrayBilinear(gray, q.x + normal.x * 0.5,
+                                     q.y + normal.y * 0.5);
+        double in = GetGrayBilinear(gray, q.x - normal.x * 0.5,
+                                    q.y - normal.y * 0.5);
+        steps[t + kSearch] = reversed ? in - out : out - in;
+      }
+      int best = 0;
+      for (int t = 1; t < 2 * kSearch + 1; t++)
+        if (steps[t] > steps[best]) best = t;
+      if (steps[best] < kMinStep) continue;
+      double offset = 0.0;
+      if (best > 0 && best < 2 * kSearch) {
+        double l = steps[best - 1], m = steps[best], r = steps[best + 1];
+        double d = l - 2 * m + r;
+        if (d < 0) offset = 0.5 * (l - r) / d;
+      }
+      edges.push_back(s + normal * (float)(best - kSearch + offset));
+    }
+    if ((int)edges.size() < kMinPoints) return false;
+    fitLine(edges, lines[side], DIST_L2, 0, 0.01, 0.01);
+    // drop the points off the line, fit again
+    vector<Point2f> inliers;
+    for (const Point2f& e : edges) {
+      double dist = fabs((e.x - lines[side][2]) * lines[side][1] -
+                         (e.y - lines[side][3]) * lines[side][0]);
+      if (dist < 1.0) inliers.push_back(e);
+    }
+    if ((int)inliers.size() < kMinPoints) return false;
+    fitLine(inliers, lines[side], DIST_L2, 0, 0.01, 0.01);
+  }
+
+  // corner i is where side i - 1 meets side i
+  vector<Point2f> refined(4);
+  for (int i = 0; i < 4; i++) {
+    const Vec4f& l1 = lines[(i + 3) % 4];
+    const Vec4f& l2 = lines[i];
+    double det = l1[0] * l2[1] - l1[1] * l2[0];
+    if (fabs(det) < 1e-6) return false;
+    double t = ((l2[2] - l1[2]) * l2[1] - (l2[3] - l1[3]) * l2[0]) / det;
+    refined[i] = Point2f((float)(l1[2] + l1[0] * t),
+                         (float)(l1[3] + l1[1] * t));
+    Point2f shift = refined[i] - c[i];
+    if (shift.dot(shift) > kMaxShift * kMaxShift) return false;
+  }
+  c = refined;
+  return true;
+}
+
 double DatamatrixLocator::Transform4LShape(const Mat& src, const LShape& l_shape,
-                                         Mat* transformed, double w_h) {
+                                         Mat* transformed, double w_h,
+                                         Mat* matrix, const bool raw) {
   double length;
   Point lshape_vertex[] = {l_shape.p1.location, l_shape.p0.location,
                            l_shape.p2.location, l_shape.px.location};
@@ -970,16 +1734,33 @@ double DatamatrixLocator::Transform4LShape(const Mat& src, const LShape& l_shape
     length = GetDistance(lshape_vertex[3], lshape_vertex[0]);
     if (length > w_h) w_h = length;
   }
-  Transform(src, lshape_vertex, w_h, transformed);
+  Transform(src, lshape_vertex, w_h, transformed, matrix, raw);
   return w_h;
 }
 
 void DatamatrixLocator::Transform(const Mat& src, const Point* vertex,
-                                  const double w_h, Mat* transformed ) {
+                                  const double w_h, Mat* transformed,
+                                  Mat* matrix, const bool raw) {
+  Point2f src_pts[4];
+  for (int i = 0; i < 4; i++)
+    src_pts[i] = Point2f((float)vertex[i].x, (float)vertex[i].y);
+  Transform(src, src_pts, w_h, transformed, matrix, raw);
+}
+
+void DatamatrixLocator::Transform(const Mat& src, const Point2f* vertex,
+                                  const double w_h, Mat* transformed,
+                                  Mat* matrix, const bool raw) {
+  /* with a lens model, the square is mapped to the undistorted source: the
+   * vertexes are undistorted, and each pixel of the square is looked up
+   * through the lens in the raw source. only the square is remapped.
+   * an image warped already(not raw) is in undistorted coordinates, it is
+   * warped as it is. */
+  const bool through_lens = raw && !lens_.empty();
   Point2f src_pts[4];
   Point2f trans_pts[4];
   for (int i = 0; i < 4; i++) {
-    src_pts[i] = Point2f((float)vertex[i].x, (float)vertex[i].y);
+    src_pts[i] = through_lens ? Point2f(lens_.Undistort(Point2d(vertex[i])))
+                              : vertex[i];
     trans_pts[i] = Point2f(0.0, 0.0);
   }
   trans_pts[1].y += (float)w_h;
@@ -987,8 +1768,29 @@ void DatamatrixLocator::Transform(const Mat& src, const Point* vertex,
   trans_pts[2].y += (float)w_h;
   trans_pts[3].x += (float)w_h;
 
+  // only the w_h*w_h square is filled
+  const int size = (int)floor(w_h + 0.5);
   Mat m = getPerspectiveTransform(src_pts, trans_pts);
-  warpPerspective(src, *transformed, m, transformed->size());
+  if (transformed != NULL && !through_lens) {
+    warpPerspective(src, *transformed, m, Size(size, size));
+  } else if (transformed != NULL) {
+    Mat map_x(size, size, CV_32FC1), map_y(size, size, CV_32FC1);
+    Mat inverse = m.inv();
+    const double* h = inverse.ptr<double>(0);
+    for (int y = 0; y < size; y++) {
+      float* row_x = map_x.ptr<float>(y);
+      float* row_y = map_y.ptr<float>(y);
+      for (int x = 0; x < size; x++) {
+        double w = h[6] * x + h[7] * y + h[8];
+        Point2d raw = lens_.Distort(Point2d((h[0] * x + h[1] * y + h[2]) / w,
+                                            (h[3] * x + h[4] * y + h[5]) / w));
+        row_x[x] = (float)raw.x;
+        row_y[x] = (float)raw.y;
+      }
+    }
+    remap(src, *transformed, map_x, map_y, INTER_LINEAR);
+  }
+  if (matrix != NULL) *matrix = m;
   m.release();
 }
 
@@ -11,9 +11,15 @@
 #ifndef DATAMATRIX_LOCATOR_H
 #define DATAMATRIX_LOCATOR_H
 
+#include <climits>
+#include <functional>
+
 #include <opencv2/opencv.hpp>
 
+#include "bit_image.h"
 #include "image_processor.h"
+#include "lens_model.h"
+#include "reject_stats.h"
 
 namespace hyf_lemon {
 /**
@@ -59,20 +65,127 @@ typedef struct LShape_struct {
   bool reversed;
 } LShape;
 
+/**
+@struct Contour
+@brief  a contour stored as separate x[], y[] arrays, with the statistics
+        the locator needs. they are all computed by Build in 2 passes:
+        bound & extremes, then nearest points & side counters.
+        if simplified, only the vertexes of a polygon are kept, each one
+        stands for the points from it to the next vertex(weight).
+**/
+struct Contour {
+  // a point within kSideGap(px) of a side of bound is counted to the side
+  static const int kSideGap = 4;
+
+  std::vector<int> x;
+  std::vector<int> y;
+  // if simplified: index of each vertex in the points, and its weight
+  std::vector<size_contour> origin;
+  std::vector<int> weight;
+  // count of the points before simplified
+  size_contour total;
+  // the points built from, they must outlive the contour
+  const PointSeq* points;
+  cv::Rect bound;
+  // the most top, left, bottom, right points(the first one met)
+  XPoint extreme[4];
+  // the closest points to the bound vertexes: top-left, left-bottom,
+  // bottom-right, right-top
+  XPoint nearest[4];
+  // count of points beside the top, left, bottom, right side of bound
+  int side_counts[4];
+
+  /**
+    @param epsilon - simplify by Douglas-Peucker, max distance(px) of a
+                     point to the polygon. 0: not simplified
+  **/
+  void Build(const PointSeq& points, const double epsilon = 0.0);
+  size_contour size() const { return (size_contour)x.size(); }
+  cv::Point at(const size_contour i) const { return cv::Point(x[i], y[i]); }
+  size_contour Origin(const size_contour i) const {
+    return origin.empty() ? i : origin[i];
+  }
+  /**
+    @brief a point before simplified, by its index in the points built from
+  **/
+  cv::Point Raw(const size_contour i) const { return (*points)[i]; }
+};
+
 int GetDistancePow(cv::Point p1, cv::Point p2);
 double GetDistance(cv::Point p1, cv::Point p2);
 double GetAngleF(cv::Point p0, cv::Point p1);
-int GetPixValue8UC1(const cv::Mat image, cv::Point point);
+int GetPixValue8UC1(const cv::Mat& image, cv::Point point);
 int GetAngle(cv::Point p0, cv::Point p1);
+/**
+  @brief bilinear interpolated gray value, clamped to the image border
+**/
+double GetGrayBilinear(const cv::Mat& gray, double x, double y);
 cv::Point MovePixel(const cv::Point p0, const double angle,
                     const int step,
                     const int direction);
-double GetBrightRateInALine(const cv::Mat binary, const cv::Point p0,
+/**
+  @class   LineSampler
+  @brief   walk a line the same way as MovePixel, the direction is computed
+           once and each step is a fixed point(32.32) add, no trigonometry
+**/
+class LineSampler {
+ public:
+  LineSampler(const cv::Point p0, const double angle, const int direction);
+  /**
+    @brief same as MovePixel(p, angle, step, direction)
+  **/
+  cv::Point Move(const cv::Point p, const int step) const {
+    return cv::Point(Round((int64_t)p.x * kOne + step_x_ * step),
+                     Round((int64_t)p.y * kOne + step_y_ * step));
+  }
+  /**
+    @brief the point i steps from p0
+  **/
+  cv::Point At(const int i) const { return Move(p0_, i); }
+  /**
+    @brief count bright pixels of the first length points, stop once limit
+           is reached
+  **/
+  int Count(const BitImage& binary, const int length,
+            const int limit = INT_MAX) const;
+  /**
+    @brief output the first length points, 1: bright, 0: dark
+  **/
+  void Sample(const BitImage& binary, const int length, uchar* line) const;
+
+ private:
+  static const int64_t kOne = 1LL << 32;
+  static int Round(const int64_t fixed) {
+    return (int)((fixed + kOne / 2) >> 32);
+  }
+
+  cv::Point p0_;
+  int64_t step_x_;
+  int64_t step_y_;
+};
+
+/**
+  @brief  if the line is horizontal/vertical output the step of each pixel
+  @retval false - if the line is neither horizontal nor vertical
+**/
+bool GetAxisStep(const double angle, const int direction, int* dx, int* dy);
+/**
+  @param  max_rate - a sampled(not horizontal/vertical) line stops counting
+                     once the rate reaches it, the rate output is then only
+                     known to be >= max_rate
+**/
+double GetBrightRateInALine(const BitImage& binary, const cv::Point p0,
                             const double angle, const int L,
-                            const int direction);
-int GetDashNumberBright(const cv::Mat binary, const cv::Point p0,
+                            const int direction, const double max_rate = 1.0);
+int GetDashNumberBright(const BitImage& binary, const cv::Point p0,
                         const double angle, const int length,
                         const int direction);
+/**
+  @brief  count elements of a timing side
+  @param  line - 1: bright, 0: dark
+  @retval      - the count, -1: if not a timing side
+**/
+int CountDashes(const std::vector<uchar>& line);
 
 /**
   @class   DatamatrixLocator
@@ -100,48 +213,217 @@ class DatamatrixLocator {
             possibly part of a Datamatrix, then output the binarized ROI of the
             possible Datamatrixs(backgound-dark, datamatrix-bright).
     @param  data_matrixs - output possible Datamatrix images
+    @param  bounds       - optional, output where each Datamatrix image is
+                           taken from(bounding rect in source)
+    @param  homographies - optional, if given the Datamatrix images are not
+                           warped(data_matrixs is left empty), output
+                           instead the transform(3*3, CV_64F) from the unit
+                           square of each Datamatrix to source(undistorted
+                           by lens if set), for DatamatrixReader::Sample
+    @param  indices      - optional, check only these contours(in the order
+                           given), otherwise all of them
     @retval              - return the count of possible Datamatrix images
   **/
   int LocateDatamatrix(const cv::Mat& source, const ImageProcessor processor,
-                       MatVec* datamatrixs);
+                       MatVec* datamatrixs,
+                       std::vector<cv::Rect>* bounds = NULL,
+                       MatVec* homographies = NULL,
+                       const std::vector<int>* indices = NULL);
+  /**
+    @brief  same as LocateDatamatrix, but start from L shapes found without
+            the binarized image(eg. by GradientDetector), neither image nor
+            contours need to be set
+    @param  gray     - the gray source at the pyramid level of processor,
+                       where l_shapes are found
+    @param  l_shapes - p0, p1, p2 and angles, as GetLShape outputs
+    @param  indices  - optional, check only these L shapes
+    @retval          - return the count of possible Datamatrix images
+  **/
+  int LocateLShapes(const cv::Mat& source, const cv::Mat& gray,
+                    const ImageProcessor processor,
+                    const std::vector<LShape>& l_shapes, MatVec* datamatrixs,
+                    std::vector<cv::Rect>* bounds = NULL,
+                    MatVec* homographies = NULL,
+                    const std::vector<int>* indices = NULL);
 
   // setter & getter
   cv::Mat image() const { return image_; }
+  /**
+    @brief set the binarized image, then pack it to bits
+  **/
   void set_image(const cv::Mat& source);
+  /**
+    @brief set the binarized image with its bits packed by ImageProcessor
+  **/
+  void set_image(const cv::Mat& source, const BitImage& bits);
 
   std::vector<PointSeq> contours() const { return contours_; };
   void set_contours(const std::vector<PointSeq> contours);
+  /**
+    @brief  score each contour cheaply(see ScoreCandidate) so that the best
+            ones can be located first. the L shapes found are kept for
+            LocateDatamatrix until the contours are set again
+  **/
+  void ScoreContours(std::vector<double>* scores);
+  int threads() const { return threads_; }
+  /**
+    @brief 1: check the contours one by one, otherwise they are shared among
+           the threads of cv::parallel_for_ (0: as many as OpenCV uses)
+  **/
+  void set_threads(const int val) { threads_ = val; }
+  bool subpixel() const { return subpixel_; }
+  /**
+    @brief fit the sides of each Datamatrix in subpixel on source before the
+           last transform
+  **/
+  void set_subpixel(const bool val) { subpixel_ = val; }
+  double simplify() const { return simplify_; }
+  /**
+    @brief simplify each contour to a polygon before looking for the L shape,
+           val: max distance(px) of a point to the polygon, 0: not simplified
+  **/
+  void set_simplify(const double val) { simplify_ = val; }
+  int min_module() const { return min_module_; }
+  /**
+    @brief the min size(px) of a Datamatrix element, a side of the L shape is
+           10 elements at least. default 4, as ImageProcessor
+  **/
+  void set_min_module(const int val) { min_module_ = val > 1 ? val : 1; }
+  /**
+    @brief candidates tried and rejected(by reason) since ResetStats, only
+           the reasons of the locator are counted
+  **/
+  const RejectStats& stats() const { return stats_; }
+  const LensModel& lens() const { return lens_; }
+  /**
+    @brief locate on the raw source, but warp each Datamatrix(and output its
+           homography) in the undistorted source
+  **/
+  void set_lens(const LensModel& val) { lens_ = val; }
+  void ResetStats() { stats_.Reset(); }
 
  private:
+  /**
+    @struct Candidate
+    @brief  what one contour is located to
+  **/
+  struct Candidate {
+    bool good = false;
+    cv::Rect bound;
+    cv::Mat datamatrix;
+    cv::Mat homography;
+    RejectReason reject = REJECT_NONE;
+  };
+  /**
+    @struct Scored
+    @brief  what ScoreCandidate finds in one contour, located from on
+  **/
+  struct Scored {
+    // the L shape is found, if not the contour is released
+    bool found = false;
+    bool orthogonal = false;
+    Contour contour;
+    // not calibrated yet
+    LShape l_shape;
+  };
+  /**
+    @brief  mark why the candidate is rejected
+    @retval - false
+  **/
+  static bool Reject(const RejectReason reason, Candidate* candidate);
+  /**
+    @brief  the body of LocateDatamatrix for one contour, only reads members
+            so that contours can be checked in parallel
+    @param  index           - of the contour in contours_, the L shape kept
+                              by ScoreContours is used if any
+    @param  want_homography - output the homography instead of the image
+    @param  candidate       - output
+    @retval                 - true if a possible Datamatrix is found
+  **/
+  bool LocateCandidate(const cv::Mat& source, const ImageProcessor& processor,
+                       const int index, const bool want_homography,
+                       Candidate* candidate);
+  /**
+    @brief  locate from an L shape on, to the output candidate
+    @param  bits       - the binarized image the L shape is on
+    @param  offset     - where bits is in the image of pyramid level
+    @param  orthogonal - the L shape is horizontal/vertical
+    @retval            - true if a possible Datamatrix is found
+  **/
+  bool LocateLShape(const cv::Mat& source, const ImageProcessor& processor,
+                    const BitImage& bits, const cv::Point offset,
+                    const bool orthogonal, LShape l_shape,
+                    const bool want_homography, Candidate* candidate);
+  /**
+    @brief  locate n candidates(in parallel if threads allow), then output
+            the good ones in order
+    @param  locate - locate the candidate i to the slot given
+    @retval        - count of the good ones
+  **/
+  int CollectCandidates(
+      const int n_candidates,
+      const std::function<bool(const int, Candidate*)>& locate,
+      MatVec* datamatrixs, std::vector<cv::Rect>* bounds,
+      MatVec* homographies);
+  /**
+    @brief  the fast path of a horizontal/vertical Datamatrix: cut it out of
+            source and turn it by transpose/flip, no perspective transform
+    @param  l_shape - with px, tight to the Datamatrix, at source resolution
+    @retval         - false : if it is not a rectangle in line with the axes
+  **/
+  bool CropOrthogonal(const cv::Mat& source, const LShape& l_shape,
+                      const bool want_homography, Candidate* candidate);
+  /**
+    @brief  warp the L shape to a thumbnail(64*64), check if both timing
+            sides are there before the full warp
+    @param  l_shape - with px, at source resolution
+    @retval         - false : if no timing side is found
+  **/
+  bool CheckThumbnail(const cv::Mat& source, const LShape& l_shape,
+                      const bool reversed);
   /**
     @brief  Get bounding rect of a contour
     @param  coutour - input
     @param  vertex  - output points in the contour which are the closest
     @retval         - bounding rect
   **/
-  cv::Rect GetBoundingRect(const PointSeq contour, XPoint* vertex);
+  cv::Rect GetBoundingRect(const Contour& contour, XPoint* vertex);
   /**
     @brief  check if the coutour is orthogonal(horizontal/vertical), if true
             output the L shape
     @param  coutour - input
-    @param  bound   - input: the bound of the contour
     @param  l_shape - output
     @retval         - return whether it is orthogonal
   **/
-  bool CheckOrthogonal(const PointSeq contour, const cv::Rect bound,
-                       LShape* l_shape);
+  bool CheckOrthogonal(const Contour& contour, LShape* l_shape);
   /**
     @brief  if the coutour is not orthogonal, use GetLShape
   **/
-  bool GetLShape(const PointSeq contour, const cv::Rect bound,
-                 const XPoint* vertex, LShape* l_shape);
+  bool GetLShape(const Contour& contour, const cv::Rect bound,
+                 const XPoint* vertex, LShape* l_shape,
+                 double* straightness = NULL);
+  /**
+    @brief  build the contour and look for its L shape, the first checks of
+            LocateCandidate
+    @param  scored       - output
+    @param  straightness - output, see GetLShape
+    @retval              - scored->found
+  **/
+  bool FindLShape(const PointSeq& points, Scored* scored,
+                  double* straightness = NULL);
+  /**
+    @brief  a cheap score(0~1) of how much a contour looks like a Datamatrix
+    @param  scored - output, kept for LocateCandidate
+    @retval - 0 : if it has no L shape, LocateCandidate would drop it at once
+  **/
+  double ScoreCandidate(const PointSeq& points, Scored* scored);
   /**
     @brief  calibrate the angles of p0-p1 & p0-p2, and p1, p2 location
   **/
-  bool CalibrateLShape(const PointSeq contour, LShape* l_shape);
-  bool CalibrateAngle(const PointSeq contour, const XPoint p0,
+  bool CalibrateLShape(const Contour& contour, LShape* l_shape);
+  bool CalibrateAngle(const Contour& contour, const XPoint p0,
                       const int direction, XPoint* p, double* angle);
-  void CalibrateP1P2(const PointSeq contour, const XPoint best_point,
+  void CalibrateP1P2(const Contour& contour, const XPoint best_point,
                      const int angle, const int direction, const int orient,
                      XPoint* p);
   void CalibrateP0(LShape* l_shape);
@@ -151,31 +433,103 @@ class DatamatrixLocator {
     @param  l_shape - 
     @retval         - false : if not 
   **/
-  bool CheckBlankL(LShape* l_shape);
+  bool CheckBlankL(const BitImage& image, LShape* l_shape);
   /**
     @brief  calc the px pf LShape
     @param  padding - move p1/p2 inside several pixes beforehand
     @param  l_shape - 
     @retval         - false : if can not find px
   **/
-  bool SetPx(const cv::Mat& image, const int padding, LShape* l_shape);
+  bool SetPx(const BitImage& image, const int padding, LShape* l_shape);
+  /**
+    @brief  find the first rotation(in the order given) of a blank line from
+            p, each 1 degree: up to 31 lines, as many as the sweep it
+            replaced. only the pixels of a line are cut, it stops counting
+            once it is not blank
+    @param  base_angle - angle of the line when rotation is 0
+    @param  order      - +1: rotate from -limit to +limit, -1: the reverse
+    @param  length     - length of the line when rotation is 0
+    @param  angle      - output the angle of the blank line
+    @param  L          - output the length of the blank line
+    @retval            - false : if no blank line
+  **/
+  bool SearchBlankLine(const BitImage& image, const cv::Point p,
+                       const double base_angle, const int order,
+                       const double length, double* angle, int* L);
   /**
     @brief pushing L shape inside, until both reach a position that bright
            rate is big
     @param padding_back - true: after padding in, padding back 1 px
     @param lShape      - 
   **/
-  void PaddingLShape(const cv::Mat& image,  const bool padding_back,
+  void PaddingLShape(const BitImage& image, const bool padding_back,
                      LShape* lShape);
-  bool EnlargeLShape(LShape* l_shape);
+  /**
+    @brief move the vertexes of L shape by offset
+  **/
+  void ShiftLShape(const cv::Point offset, LShape* l_shape);
+  /**
+    @brief multiply the vertexes of L shape, when it is located on a
+           downsampled(pyramid) image
+  **/
+  void ScaleLShape(const int scale, LShape* l_shape);
+  /**
+    @brief  push the 4 vertexes outside
+    @param  image   - the image to transform, vertexes must stay inside it
+    @param  kSize   - pixels to push
+    @retval         - false : if any vertex is out of image
+  **/
+  bool EnlargeLShape(const cv::Mat& image, const int kSize, LShape* l_shape);
+  /**
+    @brief  transform the L shape(p1,p0,p2,px) to a square image
+    @param  transformed - output, allocated as w_h*w_h(rounded), NULL: only
+                          calculate the matrix
+    @param  w_h         - side of the square, -1: the longest side of L shape
+    @param  matrix      - optional, output the perspective matrix
+    @param  raw         - src is the raw source, see Transform
+    @retval             - w_h
+  **/
   double Transform4LShape(const cv::Mat& src, const LShape& lShape,
-                          cv::Mat* transformed, double w_h = -1.0);
+                          cv::Mat* transformed, double w_h = -1.0,
+                          cv::Mat* matrix = NULL, const bool raw = true);
+  /**
+    @brief  transform the 4 vertexes(in src) to a square image
+    @param  matrix - optional, output the perspective matrix from the
+                     undistorted src to the square
+    @param  raw    - src is the raw source: warped through lens_ if set.
+                     false for an image warped already, no lens at all
+  **/
   void Transform(const cv::Mat& src, const cv::Point* vertex, const double w_h,
-                 cv::Mat* transformed);
+                 cv::Mat* transformed, cv::Mat* matrix = NULL,
+                 const bool raw = true);
+  void Transform(const cv::Mat& src, const cv::Point2f* vertex,
+                 const double w_h, cv::Mat* transformed,
+                 cv::Mat* matrix = NULL, const bool raw = true);
+  /**
+    @brief  refine the 4 corners(p1, p0, p2, px) in subpixel: fit each side
+            to the edge points across it, then intersect the sides
+    @param  gray     - the gray source
+    @param  reversed - the datamatrix is bright
+    @param  corners  - input & output
+    @retval          - false : if a side can not be fitted, corners unchanged
+  **/
+  bool RefineCorners(const cv::Mat& gray, const bool reversed,
+                     std::vector<cv::Point2f>* corners);
   
 
   cv::Mat image_;
+  // image_ packed, all the line scans read it
+  BitImage bits_;
   std::vector<PointSeq> contours_;
+  // one per contour of contours_ once scored, empty otherwise
+  std::vector<Scored> scored_;
+  int threads_;
+  bool subpixel_;
+  double simplify_;
+  int min_module_;
+  // counted in the calling thread, after the candidates are merged
+  RejectStats stats_;
+  LensModel lens_;
 };
 
 }  // namespace hyf_lemon
@@ -21,8 +21,26 @@ using namespace cv;
 
 namespace hyf_lemon {
 
-DatamatrixReader::DatamatrixReader() {}
-DatamatrixReader::DatamatrixReader(const Mat& source) { image_ = source; }
+/**
+ * @brief map a point of the unit square through a homography(CV_64F)
+ */
+static Point2d MapPoint(const Mat& homography, const double u,
+                        const double v) {
+  const double* h = homography.ptr<double>(0);
+  double w = h[6] * u + h[7] * v + h[8];
+  return Point2d((h[0] * u + h[1] * v + h[2]) / w,
+                 (h[3] * u + h[4] * v + h[5]) / w);
+}
+
+DatamatrixReader::DatamatrixReader() {
+  supersample_ = 1;
+  reject_ = REJECT_NONE;
+}
+DatamatrixReader::DatamatrixReader(const Mat& source) {
+  image_ = source;
+  supersample_ = 1;
+  reject_ = REJECT_NONE;
+}
 DatamatrixReader::~DatamatrixReader() {
   if (!image_.empty()) {
     image_.release();
@@ -38,24 +56,28 @@ void DatamatrixReader::set_image(const Mat& source) {
 
 int DatamatrixReader::Read(const ImageProcessor& processor,
                            vector<int>* codes) {
-  Mat binary = image_.clone();
-  ImageProcessor p = processor;
-  p.set_image(binary);
-  vector<PointSeq> no_use;
-  p.Process(&binary, &no_use);
+  reject_ = REJECT_NONE;
+  Mat binary;
+  processor.Binarize(image_, &binary);
 
   int image_w_h = image_.cols;
 
   int padding_down_count, padding_left_count;
-  if (!PaddingDash(binary, &padding_down_count, &padding_left_count)) return -1;
+  BitImage bits(binary);
+  if (!PaddingDash(bits, &padding_down_count, &padding_left_count)) {
+    reject_ = REJECT_PADDING_DASH;
+    return -1;
+  }
 
   Rect roi(0, padding_down_count, image_w_h - padding_left_count,
            image_w_h - padding_down_count);
   Mat datamatrix_bin = binary(roi).clone();
   Mat datamatrix_orig = image_(roi).clone();
+  bits.Pack(datamatrix_bin);
   int size_hori = -1, size_vert = -1;  // !!! datamatrix code size (m*n) !!!
 
-  if (!GetCodeSize(datamatrix_bin, image_w_h, &size_hori, &size_vert)) {
+  if (!GetCodeSize(bits, image_w_h, &size_hori, &size_vert)) {
+    reject_ = REJECT_CODE_SIZE;
     binary.release();
     datamatrix_orig.release();
     datamatrix_bin.release();
@@ -65,7 +87,7 @@ int DatamatrixReader::Read(const ImageProcessor& processor,
   // set grid
   int* row_position = new int[size_vert + 1];
   int* col_position = new int[size_hori + 1];
-  SetGrid(datamatrix_bin, size_vert, size_hori, row_position, col_position);
+  SetGrid(bits, size_vert, size_hori, row_position, col_position);
   // score
   double* scores = new double[size_hori * size_vert];
   double dark_avrage, bright_avrage;
@@ -90,7 +112,185 @@ int DatamatrixReader::Read(const ImageProcessor& processor,
   return size_hori;
 }
 
-bool DatamatrixReader::PaddingDash(const Mat& binarized,
+int DatamatrixReader::Sample(const ImageProcessor& processor, const Mat& source,
+                             const Mat& homography, vector<int>* codes) {
+  /* read straight from the gray source, no warped image: count the dashes on
+   * both timing sides, then sample the center of each element through the
+   * homography(and the lens, to the raw source). the threshold lies between
+   * the known bright and dark elements of the L shape and the timing sides.
+   * the elements are not assumed evenly spread over the square: the pitch
+   * and phase of each axis are fitted to the subpixel edges of its timing
+   * side, so the centers still hit elements of 2~3 pixels. */
+  const int kTryTimes = 6;
+  // samples per source pixel along the timing sides
+  const int kTimingDensity = 2;
+  // datamatrix elements are dark unless reversed, code 1 is an element
+  const bool reversed = processor.bin_reversed();
+  // the only way Sample fails: the elements can not be counted
+  reject_ = REJECT_CODE_SIZE;
+
+  // samples per side: about kTimingDensity per source pixel
+  Point2d corners[] = {lens_.Distort(MapPoint(homography, 0.0, 0.0)),
+                       lens_.Distort(MapPoint(homography, 1.0, 0.0)),
+                       lens_.Distort(MapPoint(homography, 1.0, 1.0)),
+                       lens_.Distort(MapPoint(homography, 0.0, 1.0))};
+  double side = 0.0;
+  int i, j;
+  for (i = 0; i < 4; i++) {
+    Point2d d = corners[i] - corners[(i + 1) % 4];
+    side = std::max(side, sqrt(d.x * d.x + d.y * d.y));
+  }
+  const int pixels = (int)ceil(side);
+  if (pixels < 16) return -1;
+  const int length = pixels * kTimingDensity;
+
+  // timing sides: top(left -> right), right(bottom -> top)
+  int size_hori = -1, size_vert = -1;
+  // per side, in samples: the edge of element k at origin + k * pitch
+  double origins[2], pitches[2];
+  vector<double> values(length), best_values;
+  vector<uchar> line(length);
+  for (int side_idx = 0; side_idx < 2; side_idx++) {
+    int max_size = -1;
+    double best_th = 0.0;
+    for (j = 0; j < kTryTimes; ++j) {
+      // the rows are 1 pixel apart, only the samples along are denser
+      double inside = (j + 0.5) / pixels;
+      double total = 0.0;
+      for (i = 0; i < length; i++) {
+        double along = (i + 0.5) / length;
+        Point2d p = lens_.Distort(
+            side_idx == 0 ? MapPoint(homography, along, inside)
+                          : MapPoint(homography, 1.0 - inside, 1.0 - along));
+        values[i] = GetGrayBilinear(source, p.x, p.y);
+        total += values[i];
+      }
+      double th = total / length;
+      for (i = 0; i < length; i++)
+        line[i] = (values[i] < th) != reversed ? 1 : 0;
+      int size = CountDashes(line);
+      if (size >= max_size) {
+        max_size = size;
+        best_values = values;
+        best_th = th;
+      }
+    }
+    if (side_idx == 0)
+      size_hori = max_size;
+    else
+      size_vert = max_size;
+    // evenly spread if the edges can not be fitted
+    if (max_size <= 0 || !FitTiming(best_values, best_th, max_size,
+                                    &origins[side_idx], &pitches[side_idx])) {
+      origins[side_idx] = 0.0;
+      pitches[side_idx] = max_size > 0 ? (double)length / max_size : 0.0;
+    }
+  }
+  if (size_hori < 10 || size_vert < 8) return -1;
+
+  // element centers and sizes on the unit square
+  vector<double> centers_u(size_hori), centers_v(size_vert);
+  for (i = 0; i < size_hori; i++)
+    centers_u[i] = (origins[0] + (i + 0.5) * pitches[0]) / length;
+  // the right side is sampled from the bottom
+  for (j = 0; j < size_vert; j++)
+    centers_v[j] =
+        1.0 - (origins[1] + (size_vert - 1 - j + 0.5) * pitches[1]) / length;
+  const double pitch_u = pitches[0] / length, pitch_v = pitches[1] / length;
+
+  // elements, (supersample_)^2 points spread over the center half of each
+  vector<double> elements((size_t)size_hori * size_vert);
+  const int n_sub = supersample_ > 0 ? supersample_ : 1;
+  double sum_1 = 0.0, sum_0 = 0.0;
+  int n_1 = 0, n_0 = 0;
+  for (j = 0; j < size_vert; j++) {
+    for (i = 0; i < size_hori; i++) {
+      double value = 0.0;
+      for (int b = 0; b < n_sub; b++) {
+        for (int a = 0; a < n_sub; a++) {
+          double u = centers_u[i] + ((a + 0.5) / n_sub - 0.5) * 0.5 * pitch_u;
+          double v = centers_v[j] + ((b + 0.5) / n_sub - 0.5) * 0.5 * pitch_v;
+          Point2d p = lens_.Distort(MapPoint(homography, u, v));
+          value += GetGrayBilinear(source, p.x, p.y);
+        }
+      }
+      value /= n_sub * n_sub;
+      elements[(size_t)size_hori * j + i] = value;
+
+      // L shape: left & bottom, timing: top & right
+      int known = -1;
+      if (i == 0 || j == size_vert - 1)
+        known = 1;
+      else if (j == 0)
+        known = i % 2 == 0 ? 1 : 0;
+      else if (i == size_hori - 1)
+        known = (size_vert - 1 - j) % 2 == 0 ? 1 : 0;
+      if (known == 1) {
+        sum_1 += value;
+        n_1++;
+      } else if (known == 0) {
+        sum_0 += value;
+        n_0++;
+      }
+    }
+  }
+  if (n_1 == 0 || n_0 == 0) return -1;
+  const double mean_1 = sum_1 / n_1, mean_0 = sum_0 / n_0;
+  const double th = (mean_1 + mean_0) / 2;
+  for (size_t n = 0; n < elements.size(); n++)
+    codes->push_back((elements[n] < th) == (mean_1 < mean_0) ? 1 : 0);
+  reject_ = REJECT_NONE;
+
+#ifdef DEBUG_DM_READER
+  printf("DataMatrix Sampler: size_hori: %d, size_vert: %d, pitch: %.2f, "
+         "%.2f px\n", size_hori, size_vert, pitches[0] / kTimingDensity,
+         pitches[1] / kTimingDensity);
+#endif  // DEBUG_DM_READER
+
+  return size_hori;
+}
+
+bool DatamatrixReader::FitTiming(const vector<double>& values, const double th,
+                                 const int size, double* origin,
+                                 double* pitch) {
+  /* the edges are where the line crosses th, interpolated between 2
+   * samples. k-th edge -> k by least squares, a timing side of size
+   * elements has exactly size - 1 edges inside. */
+  const double kMaxResidual = 0.35;  // of the pitch
+  const int n = (int)values.size();
+  vector<double> edges;
+  for (int i = 0; i + 1 < n; i++) {
+    const double a = values[i] - th, b = values[i + 1] - th;
+    if ((a < 0.0) == (b < 0.0)) continue;
+    // sample i is at i + 0.5
+    edges.push_back(i + 0.5 + a / (a - b));
+  }
+  const int n_edges = (int)edges.size();
+  if (n_edges != size - 1 || n_edges < 2) return false;
+
+  double sum_k = 0.0, sum_kk = 0.0, sum_e = 0.0, sum_ke = 0.0;
+  int k;
+  for (k = 1; k <= n_edges; k++) {
+    const double e = edges[k - 1];
+    sum_k += k;
+    sum_kk += (double)k * k;
+    sum_e += e;
+    sum_ke += k * e;
+  }
+  const double det = n_edges * sum_kk - sum_k * sum_k;
+  const double slope = (n_edges * sum_ke - sum_k * sum_e) / det;
+  if (slope <= 0.0) return false;
+  const double intercept = (sum_e - slope * sum_k) / n_edges;
+  for (k = 1; k <= n_edges; k++) {
+    if (fabs(edges[k - 1] - intercept - slope * k) > kMaxResidual * slope)
+      return false;
+  }
+  *origin = intercept;
+  *pitch = slope;
+  return true;
+}
+
+bool DatamatrixReader::PaddingDash(const BitImage& binarized,
                                    int* padding_down_count,
                                    int* padding_left_count) {
   /* padding 2 image borders of dash sides until the num of bright dots rate
@@ -136,7 +336,8 @@ bool DatamatrixReader::PaddingDash(const Mat& binarized,
   return true;
 }
 
-bool DatamatrixReader::GetCodeSize(const Mat& datamatrix, const int image_w_h,
+bool DatamatrixReader::GetCodeSize(const BitImage& datamatrix,
+                                   const int image_w_h,
                                    int* size_hori, int* size_vert) {
   const int kTryTimes = 6;
   int size_x, size_y, max_size = -1;
@@ -171,165 +372,56 @@ bool DatamatrixReader::GetCodeSize(const Mat& datamatrix, const int image_w_h,
   return true;
 }
 
-int DatamatrixReader::GetDashNumber(const Mat& datamatrix, const Point p,
+int DatamatrixReader::GetDashNumber(const BitImage& datamatrix, const Point p,
                                     const double angle, const int length,
                                     int direction) {
-  const int kMinIsland = 1;
-  const double kMin2MaxRate = 0.3;
-  Point track;
-  vector<int> bright_island;
-  vector<int> dark_island;
-  bool is_bright = false;
-  int position_bright = -1;
-  int position_dark = -1;
-  int n_bright = 0, n_dark = 0;
-
-  // check each point
-  for (int i = 0; i < length; i++) {
-    track = MovePixel(p, angle, i, direction);
-    if (!is_bright) {
-      if (length - 1 == i)
-        dark_island.push_back(i - position_dark + 1);
-      else if (GetPixValue8UC1(datamatrix, track) == 255) {
-        is_bright = true;
-        position_bright = i;
-        if (position_dark != -1) dark_island.push_back(i - position_dark);
-      }
-    }
-    if (is_bright) {
-      if (i == length - 1)
-        bright_island.push_back(i - position_bright + 1);
-      else if (GetPixValue8UC1(datamatrix, track) == 0) {
-        is_bright = false;
-        bright_island.push_back(i - position_bright);
-        position_dark = i;
-      }
-    }
-  }
-
-  // count and ignore little island
-  int min = 10000, max = 0;
-  int current, j;
-  for (j = 0; j < bright_island.size(); j++) {
-    current = bright_island[j];
-    if (current > kMinIsland) {
-      n_bright++;
-      if (current < min) min = current;
-      if (current > max) max = current;
-    }
-  }
-  bright_island.clear();
-  vector<int>().swap(bright_island);
-  if (double(min) / max < kMin2MaxRate) {
-    dark_island.clear();
-    vector<int>().swap(dark_island);
-    return -1;
-  }
-  //
-  min = 10000, max = 0;
-  for (j = 0; j < dark_island.size(); j++) {
-    current = dark_island[j];
-    if (current > kMinIsland) {
-      n_dark++;
-      if (current < min) min = current;
-      if (current > max) max = current;
-    }
-  }
-  dark_island.clear();
-  vector<int>().swap(dark_island);
-  if (double(min) / max < kMin2MaxRate) return -1;
-  // printf("bright+dark:%d,%d\n", n_bright, n_dark);
-  if (n_bright == n_dark || n_bright - n_dark == 1) return n_dark + n_dark;
-
-  return -1;
+  vector<uchar> line(length);
+  LineSampler(p, angle, direction).Sample(datamatrix, length, line.data());
+  return CountDashes(line);
 }
 
-void DatamatrixReader::SetGrid(const Mat& datamatrix, const int size_vert,
+void DatamatrixReader::SetGrid(const BitImage& datamatrix, const int size_vert,
                                const int size_hori, int* row_position,
                                int* col_position) {
-  // paint contours
-  Mat img_contours = Mat::zeros(datamatrix.size(), CV_8UC1);
-  vector<PointSeq> contours;
-  findContours(datamatrix, contours, RETR_LIST, CHAIN_APPROX_NONE, Point(0, 0));
-  for (size_contour i = 0; i < (size_contour)contours.size(); i++) {
-    drawContours(img_contours, contours, (int)i, Scalar(255, 255, 255), 1);
-  }
-  vector<PointSeq>().swap(contours);
+  // one pass over the code: a line of the grid is where the most pixels
+  // change between neighbouring rows(cols)
+  vector<int> row_edges, col_edges;
+  datamatrix.EdgeProfiles(&row_edges, &col_edges);
 
   // calculate every row & col
-  double block_hori = (double)datamatrix.cols / size_hori;
-  double block_vert = (double)datamatrix.rows / size_vert;
+  double block_hori = (double)datamatrix.cols() / size_hori;
+  double block_vert = (double)datamatrix.rows() / size_vert;
 
   row_position[0] = col_position[0] = 0;
-  row_position[size_vert] = datamatrix.rows - 1;
-  col_position[size_hori] = datamatrix.cols - 1;
+  row_position[size_vert] = datamatrix.rows() - 1;
+  col_position[size_hori] = datamatrix.cols() - 1;
 
   int j;
   for (j = 0; j < size_vert; j++) {
     int y = (int)floor(block_vert * j + 0.5f);
-    y = FitRow(img_contours, y);
-    row_position[j] = y;
+    row_position[j] = FitLine(row_edges, y);
   }
   for (j = 0; j < size_hori; j++) {
     int x = (int)floor(block_hori * j + 0.5f);
-    x = FitCol(img_contours, x);
-    col_position[j] = x;
-  }
-  img_contours.release();
-}
-
-int DatamatrixReader::FitRow(const Mat& img_contours, int y) {
-  int x0, x1, y0;
-  int n_bright;
-  Point p;
-  int max = 0, max_inx = -1;
-
-  x0 = 0;
-  x1 = img_contours.cols - 1;
-  for (int i = 0; i < 5; i++) {
-    n_bright = 0;
-    y0 = y - 2 + i;
-    for (int j = x0; j <= x1; j++) {
-      p.x = j;
-      p.y = y0;
-      if (GetPixValue8UC1(img_contours, p) == 255) n_bright++;
-    }
-    if (n_bright > max) {
-      max = n_bright;
-      max_inx = i;
-    }
+    col_position[j] = FitLine(col_edges, x);
   }
-
-  if (max_inx != -1) y = y - 2 + max_inx;
-
-  return y;
 }
 
-int DatamatrixReader::FitCol(const Mat& img_contours, int x) {
-  int y0, y1, x0;
-  int n_bright;
-  Point p;
+/**
+ @brief  the peak of the edge profile within 2 pixels of the position
+ @retval the position unchanged if there is no edge around
+**/
+int DatamatrixReader::FitLine(const vector<int>& edges, int position) {
+  const int kRadius = 2;
   int max = 0, max_idx = -1;
-
-  y0 = 0;
-  y1 = img_contours.rows - 1;
-  for (int i = 0; i < 5; i++) {
-    n_bright = 0;
-    x0 = x - 2 + i;
-    for (int j = y0; j <= y1; j++) {
-      p.x = x0;
-      p.y = j;
-      if (GetPixValue8UC1(img_contours, p) == 255) n_bright++;
-    }
-    if (n_bright > max) {
-      max = n_bright;
+  for (int i = position - kRadius; i <= position + kRadius; i++) {
+    if (i < 0 || i >= (int)edges.size()) continue;
+    if (edges[i] > max) {
+      max = edges[i];
       max_idx = i;
     }
   }
-
-  if (max_idx != -1) x = x - 2 + max_idx;
-
-  return x;
+  return max_idx != -1 ? max_idx : position;
 }
 
 void DatamatrixReader::ScoreGrid(const Mat& datamatrix_bin,
@@ -342,6 +434,10 @@ void DatamatrixReader::ScoreGrid(const Mat& datamatrix_bin,
   double dark_avr = 0.0, bright_avr = 0.0;
   int n_dark = 0, n_bright = 0;
   double* averages = new double[size_hori * size_vert];
+  // one pass each, then every cell is read in O(1)
+  Mat sum_bin, sum_orig;
+  integral(datamatrix_bin, sum_bin, CV_32S);
+  integral(datamatrix_orig, sum_orig, CV_32S);
 
   // set dash line
   bool odd = false;
@@ -371,9 +467,9 @@ void DatamatrixReader::ScoreGrid(const Mat& datamatrix_bin,
       int idx = size_hori * j + i;
       int x0 = col_position[i];
       int x1 = col_position[i + 1];
-      double score = GetScore(datamatrix_bin, x0, y0, x1, y1);
+      double score = GetScore(sum_bin, x0, y0, x1, y1);
       scores[idx] = score;
-      double average = GetAverage(datamatrix_orig, x0, y0, x1, y1);
+      double average = GetAverage(sum_orig, x0, y0, x1, y1);
       averages[idx] = average;
 
       if (score <= kGate1) {
@@ -395,27 +491,32 @@ void DatamatrixReader::ScoreGrid(const Mat& datamatrix_bin,
   delete[] averages;
 }
 
-double DatamatrixReader::GetScore(const Mat& src, int x0, int y0, int x1,
+int DatamatrixReader::SumRect(const Mat& sum, int x0, int y0, int x1,
+                              int y1) {
+  // the integral image is one larger than the image on both sides
+  x0 = std::min(std::max(x0, 0), sum.cols - 1);
+  x1 = std::min(std::max(x1, 0), sum.cols - 1);
+  y0 = std::min(std::max(y0, 0), sum.rows - 1);
+  y1 = std::min(std::max(y1, 0), sum.rows - 1);
+  if (x0 >= x1 || y0 >= y1) return 0;
+  const int* top = sum.ptr<int>(y0);
+  const int* bottom = sum.ptr<int>(y1);
+  return bottom[x1] - bottom[x0] - top[x1] + top[x0];
+}
+
+double DatamatrixReader::GetScore(const Mat& sum_bin, int x0, int y0, int x1,
                                   int y1) {
-  int n_bright = 0;
-  int n_total = 0;
-  int value;
-
-  for (int j = y0 + 1; j < y1; j++) {
-    for (int i = x0 + 1; i < x1; i++) {
-      value = GetPixValue8UC1(src, Point(i, j));
-      if (value > 0) n_bright++;
-      n_total++;
-    }
-  }
-  return (double)n_bright / n_total;
+  // inside the grid lines, bright pixels are 255
+  const int width = x1 - x0 - 1 > 0 ? x1 - x0 - 1 : 0;
+  const int height = y1 - y0 - 1 > 0 ? y1 - y0 - 1 : 0;
+  int n_bright = SumRect(sum_bin, x0 + 1, y0 + 1, x1, y1) / 255;
+  return (double)n_bright / (width * height);
 }
 
-double DatamatrixReader::GetCenterScore(const Mat& src, int x0, int y0, int x1,
-                                        int y1) {
+double DatamatrixReader::GetCenterScore(const Mat& sum_bin, int x0, int y0,
+                                        int x1, int y1) {
   int brightNum = 0;
   int totalNum = 0;
-  int value;
   int xBegin, xEnd;
   int yBegin, yEnd;
 
@@ -430,30 +531,18 @@ double DatamatrixReader::GetCenterScore(const Mat& src, int x0, int y0, int x1,
   else
     yBegin = (y1 + y0) / 2;
 
-  for (int j = yBegin; j <= yEnd; j++) {
-    for (int i = xBegin; i <= xEnd; i++) {
-      value = GetPixValue8UC1(src, Point(i, j));
-      if (value > 0) brightNum++;
-      totalNum++;
-    }
-  }
+  brightNum = SumRect(sum_bin, xBegin, yBegin, xEnd + 1, yEnd + 1) / 255;
+  totalNum = (xEnd - xBegin + 1) * (yEnd - yBegin + 1);
   return (double)brightNum / totalNum;
 }
 
-double DatamatrixReader::GetAverage(const Mat& src, int x0, int y0, int x1,
-                                    int y1) {
-  int total_value = 0;
-  int n_total = 0;
-  int value;
-
-  for (int j = y0 + 1; j < y1; j++) {
-    for (int i = x0 + 1; i < x1; i++) {
-      value = GetPixValue8UC1(src, Point(i, j));
-      total_value += value;
-      n_total++;
-    }
-  }
-  return (double)total_value / n_total;
+double DatamatrixReader::GetAverage(const Mat& sum_orig, int x0, int y0,
+                                    int x1, int y1) {
+  // pixels out of the image count as 0
+  const int width = std::max(x1 - x0 - 1, 0);
+  const int height = std::max(y1 - y0 - 1, 0);
+  int total_value = SumRect(sum_orig, x0 + 1, y0 + 1, x1, y1);
+  return (double)total_value / (width * height);
 }
 
 void DatamatrixReader::ReadCodes(const ImageProcessor& processor,
@@ -480,10 +569,10 @@ void DatamatrixReader::ReadCodes(const ImageProcessor& processor,
   }
 
   ImageProcessor p = processor;
-  p.set_image(*datamatrix);
   p.set_bin_reversed(true);
-  vector<PointSeq> no_use;
-  p.Process(datamatrix, &no_use);
+  p.Binarize(*datamatrix, datamatrix);
+  Mat sum_bin;
+  integral(*datamatrix, sum_bin, CV_32S);
 
   // get center score for each grid those
   for (j = 0; j < size_vert; j++) {
@@ -494,7 +583,7 @@ void DatamatrixReader::ReadCodes(const ImageProcessor& processor,
       int x0 = col_position[i];
       int x1 = col_position[i + 1];
       if (scores[idx] > kGate1 && scores[idx] < kGate2) {
-        double score = GetCenterScore(*datamatrix, x0, y0, x1, y1);
+        double score = GetCenterScore(sum_bin, x0, y0, x1, y1);
         if (score > kGate3)
           scores[idx] = 1.0;
         else
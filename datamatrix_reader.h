@@ -17,6 +17,15 @@
 
 namespace hyf_lemon {
 
+/**
+  @enum  hyf_lemon::ReadMethod
+  @brief how the codes are read from a located datamatrix
+**/
+enum ReadMethod {
+  READ_GRID,    // binarize the warped image, fit a grid on it
+  READ_SAMPLE,  // sample the gray source at each element center
+};
+
 class DatamatrixReader {
  public:
   DatamatrixReader();
@@ -32,15 +41,45 @@ class DatamatrixReader {
    * @return size_hori (if fail, return -1)
   */
   int Read(const ImageProcessor& processor, std::vector<int>* code);
+  /**
+   * @brief read binary code straight from the gray source through the
+   * homography output by DatamatrixLocator, without any warped image
+   * @param source - gray image the datamatrix is located in
+   * @param homography - from the unit square of the datamatrix to source
+   * @param code - output
+   * @return size_hori (if fail, return -1)
+   */
+  int Sample(const ImageProcessor& processor, const cv::Mat& source,
+             const cv::Mat& homography, std::vector<int>* code);
+
+  int supersample() const { return supersample_; }
+  // points per side sampled in each element, 1: only the center
+  void set_supersample(const int val) { supersample_ = val; }
+  const LensModel& lens() const { return lens_; }
+  // Sample: the homography is to the undistorted source, map through it
+  void set_lens(const LensModel& val) { lens_ = val; }
+  // why the last Read/Sample failed, REJECT_NONE if it did not
+  RejectReason reject() const { return reject_; }
 
  private:
+  /**
+   * @brief fit the pitch and phase of a timing side to its edges in subpixel,
+   * the edge between element k - 1 and k is at origin + k * pitch
+   * @param values - gray samples along the side, sample i is at i + 0.5
+   * @param th - gray level of the edges
+   * @param size - count of the elements, by CountDashes
+   * @return false - if there are not size - 1 edges, or they are uneven
+  */
+  static bool FitTiming(const std::vector<double>& values, const double th,
+                        const int size, double* origin, double* pitch);
   /**
    * @brief push inside 2 borders(dash side) -> trim them a little bit
    * @param padding_down_count - output
    * @param padding_left_count - output
    * @return true - if success
   */
-  bool PaddingDash(const cv::Mat& binarized,int* padding_down_count, int* padding_left_count);
+  bool PaddingDash(const BitImage& binarized, int* padding_down_count,
+                   int* padding_left_count);
   /**
    * @brief get number of size, size_hori*size_vert
    * @param datamatrix - input
@@ -48,28 +87,40 @@ class DatamatrixReader {
    * @param size_vert - output
    * @return true - if success
    */
-  bool GetCodeSize(const cv::Mat& datamatrix, const int image_w_h,
+  bool GetCodeSize(const BitImage& datamatrix, const int image_w_h,
                    int* size_hori, int* size_vert);
-  int GetDashNumber(const cv::Mat& datamatrix, const cv::Point p,
+  int GetDashNumber(const BitImage& datamatrix, const cv::Point p,
                     const double angle, const int length, int direction = -1);
   /**
-   * @brief set the grid of datamatrix, grid is orthogonal(horizontal/vertical)
-   * @param datamatrix 
+   * @brief set the grid of datamatrix, grid is orthogonal(horizontal/vertical).
+   *        each line is the peak of the edge profile near where it is
+   *        expected, no contours are traced
+   * @param datamatrix   - binarized, trimmed to the code
    * @param row_position - output horizontal lines of the grid
    * @param col_position - output vertival lines of the grid
   */
-  void SetGrid(const cv::Mat& datamatrix, const int size_vert, const int size_hori,
-               int* row_position, int* col_position); 
-  int FitRow(const cv::Mat& img_contours, int y);
-  int FitCol(const cv::Mat& img_contours, int x);
+  void SetGrid(const BitImage& datamatrix, const int size_vert,
+               const int size_hori, int* row_position, int* col_position);
+  int FitLine(const std::vector<int>& edges, int position);
   void ScoreGrid(const cv::Mat& datamatrix_bin, const cv::Mat& datamatrix_orig,
                  const int size_vert, const int size_hori,
                  const int* row_position, const int* col_position,
                  double* scores, double* dark_avrage, double* bright_avrage);
 
-  double GetScore(const cv::Mat& src, int x0, int y0, int x1, int y1); 
-  double GetCenterScore(const cv::Mat& src, int x0, int y0, int x1, int y1);
-  double GetAverage(const cv::Mat& src, int x0, int y0, int x1, int y1);
+  /**
+   * @brief the cell statistics below read integral images(cv::integral,
+   *        CV_32S) of the binarized or the gray code, built once per code:
+   *        each cell costs 4 lookups, whatever the module size
+  */
+  double GetScore(const cv::Mat& sum_bin, int x0, int y0, int x1, int y1);
+  double GetCenterScore(const cv::Mat& sum_bin, int x0, int y0, int x1,
+                        int y1);
+  double GetAverage(const cv::Mat& sum_orig, int x0, int y0, int x1, int y1);
+  /**
+   * @brief sum of the pixels [x0, x1) * [y0, y1), those out of the image are 0
+   * @param sum - integral image
+  */
+  static int SumRect(const cv::Mat& sum, int x0, int y0, int x1, int y1);
 
   void ReadCodes(const ImageProcessor& processor, const int size_vert,
                  const int size_hori, const int* row_position,
@@ -81,6 +132,9 @@ class DatamatrixReader {
 
 
   cv::Mat image_;
+  int supersample_;
+  RejectReason reject_;
+  LensModel lens_;
 };
 
 }  // namespace hyf_lemon
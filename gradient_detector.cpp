@@ -0,0 +1,257 @@
+/*******************************************************************************
+
+  @file      gradient_detector.cpp
+  @brief     find the solid "L" of Datamatrixs on the gray image by gradients,
+             no binarization needed
+  @details   ~
+  @author    LemonDecoder contributors
+  @date      18.10.2026
+  @copyright LemonDecoder contributors, 2026. MIT License(see LICENSE.txt)
+
+*******************************************************************************/
+//#define DEBUG_GRADIENT
+
+#include "gradient_detector.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+using std::vector;
+using namespace cv;
+
+namespace hyf_lemon {
+
+GradientDetector::GradientDetector() {
+  min_length_ = 32;
+  min_gradient_ = 80;
+}
+GradientDetector::~GradientDetector() {}
+
+int GradientDetector::Detect(const Mat& gray, const bool reversed,
+                             vector<LShape>* l_shapes, vector<Rect>* bounds) {
+  /* segments are paired with each other, the pairs are taken longest first
+   * and each segment is used only once: the outer sides of an L are its
+   * longest edges, they are taken before the shorter ones of the inside. */
+  Mat dx, dy;
+  Sobel(gray, dx, CV_16S, 1, 0, 3);
+  Sobel(gray, dy, CV_16S, 0, 1, 3);
+  vector<Segment> segments;
+  GetSegments(dx, dy, &segments);
+
+  struct Pair {
+    LShape l_shape;
+    double score;
+    int first;
+    int second;
+  };
+  vector<Pair> pairs;
+  for (int i = 0; i < (int)segments.size(); i++) {
+    for (int j = i + 1; j < (int)segments.size(); j++) {
+      Pair pair;
+      if (!PairSegments(segments[i], segments[j], reversed, &pair.l_shape,
+                        &pair.score))
+        continue;
+      pair.first = i;
+      pair.second = j;
+      pairs.push_back(pair);
+    }
+  }
+  std::stable_sort(pairs.begin(), pairs.end(),
+                   [](const Pair& a, const Pair& b) { return a.score > b.score; });
+
+  vector<uchar> used(segments.size(), 0);
+  const Rect image_rect(0, 0, gray.cols, gray.rows);
+  int n_shapes = 0;
+  for (const Pair& pair : pairs) {
+    if (used[pair.first] || used[pair.second]) continue;
+    used[pair.first] = used[pair.second] = 1;
+    l_shapes->push_back(pair.l_shape);
+    if (bounds != NULL) {
+      const LShape& l = pair.l_shape;
+      PointSeq corners = {l.p0.location, l.p1.location, l.p2.location,
+                          l.px.location};
+      bounds->push_back(boundingRect(corners) & image_rect);
+    }
+    n_shapes++;
+  }
+
+#ifdef DEBUG_GRADIENT
+  Mat drawing;
+  cvtColor(gray, drawing, COLOR_GRAY2BGR);
+  for (const Segment& s : segments)
+    line(drawing, s.a, s.b, Scalar(0, 255, 0), 1);
+  for (const LShape& l : *l_shapes) {
+    line(drawing, l.p0.location, l.p1.location, Scalar(0, 0, 255), 2);
+    line(drawing, l.p0.location, l.p2.location, Scalar(255, 0, 0), 2);
+  }
+  imshow("Gradient", drawing);
+  waitKey(0);
+#endif  // DEBUG_GRADIENT
+  return n_shapes;
+}
+
+void GradientDetector::GetSegments(const Mat& dx, const Mat& dy,
+                                   vector<Segment>* segments) {
+  /* region growing(as LSD does): seeds are taken strongest first, a pixel
+   * joins the region of its neighbour if its gradient is within
+   * kAngleTolerance of the region's mean. the region is then fitted by its
+   * principal axis, a thin and long one is a segment. */
+  const int rows = dx.rows, cols = dx.cols;
+  const float kCosTolerance = (float)cos(CV_PI * kAngleTolerance / 180.0);
+  Mat_<int> magnitude(rows, cols);
+  vector<int> seeds;
+  for (int y = 0; y < rows; y++) {
+    const short* row_x = dx.ptr<short>(y);
+    const short* row_y = dy.ptr<short>(y);
+    int* row_m = magnitude[y];
+    for (int x = 0; x < cols; x++) {
+      row_m[x] = abs(row_x[x]) + abs(row_y[x]);
+      if (row_m[x] >= min_gradient_) seeds.push_back(y * cols + x);
+    }
+  }
+  std::stable_sort(seeds.begin(), seeds.end(), [&](int a, int b) {
+    return magnitude(a / cols, a % cols) > magnitude(b / cols, b % cols);
+  });
+
+  Mat_<uchar> used = Mat_<uchar>::zeros(rows, cols);
+  auto unit = [&](const int x, const int y) {
+    Point2f g(dx.at<short>(y, x), dy.at<short>(y, x));
+    return g * (float)(1.0 / sqrt(g.dot(g)));
+  };
+  vector<int> region;
+  for (int seed : seeds) {
+    const int seed_x = seed % cols, seed_y = seed / cols;
+    if (used(seed_y, seed_x)) continue;
+    used(seed_y, seed_x) = 1;
+    region.assign(1, seed);
+    Point2f sum = unit(seed_x, seed_y);
+    for (size_t k = 0; k < region.size(); k++) {
+      const int x = region[k] % cols, y = region[k] / cols;
+      const float norm = (float)sqrt(sum.dot(sum));
+      for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, rows - 1); ny++) {
+        for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, cols - 1);
+             nx++) {
+          if (used(ny, nx) || magnitude(ny, nx) < min_gradient_) continue;
+          Point2f g = unit(nx, ny);
+          if (g.dot(sum) < kCosTolerance * norm) continue;
+          used(ny, nx) = 1;
+          region.push_back(ny * cols + nx);
+          sum += g;
+        }
+      }
+    }
+    if ((int)region.size() < min_length_) continue;
+
+    // principal axis of the region
+    double mx = 0.0, my = 0.0;
+    for (int p : region) mx += p % cols, my += p / cols;
+    mx /= region.size();
+    my /= region.size();
+    double sxx = 0.0, syy = 0.0, sxy = 0.0;
+    for (int p : region) {
+      double ex = p % cols - mx, ey = p / cols - my;
+      sxx += ex * ex;
+      syy += ey * ey;
+      sxy += ex * ey;
+    }
+    sxx /= region.size();
+    syy /= region.size();
+    sxy /= region.size();
+    const double theta = 0.5 * atan2(2.0 * sxy, sxx - syy);
+    const double half = 0.5 * (sxx + syy);
+    const double root = sqrt(0.25 * (sxx - syy) * (sxx - syy) + sxy * sxy);
+    // spread across the axis: a wide region is a blob, not an edge
+    if (sqrt(std::max(half - root, 0.0)) > kMaxWidth / 2) continue;
+    const Point2f direction((float)cos(theta), (float)sin(theta));
+    float t_min = 0.0f, t_max = 0.0f;
+    for (int p : region) {
+      float t = (float)((p % cols - mx) * direction.x +
+                        (p / cols - my) * direction.y);
+      t_min = std::min(t_min, t);
+      t_max = std::max(t_max, t);
+    }
+    if (t_max - t_min < min_length_) continue;
+
+    Segment segment;
+    const Point2f center((float)mx, (float)my);
+    segment.a = center + direction * t_min;
+    segment.b = center + direction * t_max;
+    segment.direction = direction;
+    segment.gradient = sum * (float)(1.0 / sqrt(sum.dot(sum)));
+    segment.length = t_max - t_min;
+    segments->push_back(segment);
+  }
+}
+
+bool GradientDetector::PairSegments(const Segment& s1, const Segment& s2,
+                                    const bool reversed, LShape* l_shape,
+                                    double* score) {
+  /* the lines of both segments meet at the corner p0, which must be close
+   * to an end of each. the other ends are p1, p2. the datamatrix lies
+   * between both sides: on the dark side of each edge, or the bright side if
+   * reversed, i.e. each gradient points away from the other side. */
+  const float kMaxGap = 6.0f;  // px, a corner is rounded by the gradients
+  const float sine = s1.direction.x * s2.direction.y -
+                     s1.direction.y * s2.direction.x;
+  if (fabs(sine) < cos(CV_PI * kRightAngleTolerance / 180.0)) return false;
+
+  // a1 + t * d1 == a2 + u * d2
+  const Point2f w = s2.a - s1.a;
+  const float t = (w.x * s2.direction.y - w.y * s2.direction.x) / sine;
+  const float u = (w.x * s1.direction.y - w.y * s1.direction.x) / sine;
+  const Point2f corner = s1.a + s1.direction * t;
+  const float gap =
+      std::max(kMaxGap, 0.1f * std::min(s1.length, s2.length));
+  // the far end of a segment from the corner, t: corner's position on it
+  auto far_end = [&](const Segment& s, const float t, Point2f* end) {
+    if (fabs(t) <= gap) {
+      *end = s.b;
+      return true;
+    }
+    if (fabs(t - s.length) <= gap) {
+      *end = s.a;
+      return true;
+    }
+    return false;
+  };
+  Point2f end1, end2;
+  if (!far_end(s1, t, &end1) || !far_end(s2, u, &end2)) return false;
+  Point2f side1 = end1 - corner, side2 = end2 - corner;
+  const double length1 = sqrt(side1.dot(side1));
+  const double length2 = sqrt(side2.dot(side2));
+  if (length1 < min_length_ || length2 < min_length_) return false;
+  const double aspect = std::min(length1, length2) / std::max(length1, length2);
+  if (aspect < kMinAspect) return false;
+
+  // polarity
+  const float sign = reversed ? -1.0f : 1.0f;
+  if (sign * s1.gradient.dot(side2) >= 0.0f ||
+      sign * s2.gradient.dot(side1) >= 0.0f)
+    return false;
+
+  // p1, p2 turn the same way as a contour: (p2 - p0) x (p1 - p0) < 0
+  if (side2.x * side1.y - side2.y * side1.x > 0.0f) std::swap(side1, side2);
+  const Point p0(cvRound(corner.x), cvRound(corner.y));
+  l_shape->p0.location = p0;
+  l_shape->p1.location = Point(cvRound(corner.x + side1.x),
+                               cvRound(corner.y + side1.y));
+  l_shape->p2.location = Point(cvRound(corner.x + side2.x),
+                               cvRound(corner.y + side2.y));
+  l_shape->px.location =
+      l_shape->p1.location + l_shape->p2.location - l_shape->p0.location;
+  l_shape->p0.index = l_shape->p1.index = l_shape->p2.index = -1;
+  l_shape->px.index = -1;
+  l_shape->position = 0;  // redefined by the locator
+  l_shape->angle1 = GetAngleF(l_shape->p0.location, l_shape->p1.location);
+  l_shape->angle2 = GetAngleF(l_shape->p0.location, l_shape->p2.location);
+  l_shape->reversed = false;
+  if (fabs(l_shape->angle1 - l_shape->angle2) < 45.0 ||
+      fabs(l_shape->angle1 - l_shape->angle2) > 135.0)
+    return false;
+
+  *score = length1 + length2;
+  return true;
+}
+
+}  // namespace hyf_lemon
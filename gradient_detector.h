@@ -0,0 +1,101 @@
+/*******************************************************************************
+
+  @file      gradient_detector.h
+  @brief     find the solid "L" of Datamatrixs on the gray image by gradients,
+             no binarization needed
+  @details   ~
+  @author    LemonDecoder contributors
+  @date      18.10.2026
+  @copyright LemonDecoder contributors, 2026. MIT License(see LICENSE.txt)
+
+*******************************************************************************/
+#ifndef GRADIENT_DETECTOR_H_
+#define GRADIENT_DETECTOR_H_
+
+#include <opencv2/opencv.hpp>
+
+#include "datamatrix_locator.h"
+
+namespace hyf_lemon {
+
+/**
+  @class   GradientDetector
+  @brief   detect line segments on the gray image: pixels of strong gradient
+           are grown into regions of the same orientation, each region is
+           fitted to a segment. 2 long segments which are perpendicular, meet
+           at a corner and both face outwards(polarity) make an "L" shape.
+  @details the L shapes are the same as DatamatrixLocator gets from a
+           contour, they are then checked by CheckBlankL & SetPx
+**/
+class GradientDetector {
+ public:
+  GradientDetector();
+  ~GradientDetector();
+
+  /**
+    @brief  detect the L shapes, best first
+    @param  gray     - 8-bit gray image
+    @param  reversed - the datamatrix is bright on a dark background
+    @param  l_shapes - output, p0: the corner, p1 & p2: end of each side
+    @param  bounds   - optional, output the bounding rect of each L shape
+                       closed by its 4th vertex
+    @retval          - count of the L shapes
+  **/
+  int Detect(const cv::Mat& gray, const bool reversed,
+             std::vector<LShape>* l_shapes,
+             std::vector<cv::Rect>* bounds = NULL);
+
+  // setter & getter
+  int min_length() const { return min_length_; }
+  /**
+    @brief the min length(px) of a side of the L shape
+  **/
+  void set_min_length(const int val) { min_length_ = val; }
+  int min_gradient() const { return min_gradient_; }
+  /**
+    @brief the min gradient(|dx| + |dy| of 3*3 Sobel) of an edge pixel
+  **/
+  void set_min_gradient(const int val) { min_gradient_ = val; }
+
+ private:
+  /**
+    @struct Segment
+    @brief  a straight edge: its 2 ends, unit direction from a to b, and the
+            mean gradient(unit, pointing to the bright side)
+  **/
+  struct Segment {
+    cv::Point2f a;
+    cv::Point2f b;
+    cv::Point2f direction;
+    cv::Point2f gradient;
+    float length;
+  };
+  /**
+    @brief grow regions of the same gradient orientation and fit each one to
+           a segment
+  **/
+  void GetSegments(const cv::Mat& dx, const cv::Mat& dy,
+                   std::vector<Segment>* segments);
+  /**
+    @brief  check if 2 segments make an L shape
+    @param  score - output, length of both sides
+    @retval       - false : if not
+  **/
+  bool PairSegments(const Segment& s1, const Segment& s2, const bool reversed,
+                    LShape* l_shape, double* score);
+
+  int min_length_;
+  int min_gradient_;
+  // max angle(degree) between 2 pixels of the same region
+  const double kAngleTolerance = 22.5;
+  // max deviation(degree) of the L shape from 90 degree
+  const double kRightAngleTolerance = 15.0;
+  // max width(px) of an edge, a region wider than it is not straight
+  const float kMaxWidth = 3.0f;
+  // the shorter side over the longer, same as GetLShape
+  const double kMinAspect = 0.2;
+};
+
+}  // namespace hyf_lemon
+
+#endif  // GRADIENT_DETECTOR_H_
@@ -12,6 +12,8 @@
 #include "image_processor.h"
 #include "datamatrix_locator.h"
 
+#include <algorithm>
+
 using std::vector;
 using namespace cv;
 
@@ -31,7 +33,11 @@ ImageProcessor::~ImageProcessor() { image_.release(); }
 void ImageProcessor::Initialize() {
   bin_method_ = BIN_ADAPTIVE;
   bin_adaptive_block_ = 25;
+  bin_adaptive_auto_ = false;
+  module_pitch_ = 0;
   bin_normal_th_ = 127;
+  pyramid_level_ = 0;
+  min_module_ = 4;
 }
 
 void ImageProcessor::set_image(const Mat& source) {
@@ -41,30 +47,123 @@ void ImageProcessor::set_image(const Mat& source) {
   image_ = source.clone();
 }
 
+void ImageProcessor::set_pyramid_level(const unsigned val) {
+  pyramid_level_ = val > kMaxPyramidLevel ? kMaxPyramidLevel : val;
+}
+
+void ImageProcessor::set_expected_module(const unsigned val) {
+  unsigned level = 0;
+  while (level < kMaxPyramidLevel && (int)(val >> (level + 1)) >= min_module_)
+    level++;
+  pyramid_level_ = level;
+}
+
+void ImageProcessor::Shrink(const Mat& source, Mat* output) const {
+  if (pyramid_level_ == 0) {
+    *output = source;
+    return;
+  }
+  double factor = 1.0 / pyramid_scale();
+  resize(source, *output, Size(), factor, factor, INTER_AREA);
+}
+
+int ImageProcessor::EstimateModulePitch() {
+  /* sample every kLineStep rows and cols, split them into dark/bright runs
+   * by the global mean. runs of a single element are the most frequent ones
+   * inside a datamatrix, so the peak of the run-length histogram is the
+   * pitch. the block then covers about 2.5 elements. */
+  const int kLineStep = 4;
+  const int kMinRun = 2, kMaxRun = 64;
+  const int kMinRunCount = 64;
+  const double kBlockPerPitch = 2.5;
+  const int kMinBlock = 9, kMaxBlock = 99;
+  if (image_.empty()) return 0;
+
+  const int th = (int)mean(image_)[0];
+  vector<int> hist(kMaxRun + 2, 0);
+  int n_runs = 0;
+  int x, y;
+  for (y = 0; y < image_.rows; y += kLineStep) {
+    const uchar* row = image_.ptr<uchar>(y);
+    bool dark = row[0] < th;
+    int start = 0;
+    for (x = 1; x <= image_.cols; x++) {
+      if (x < image_.cols && (row[x] < th) == dark) continue;
+      int run = x - start;
+      if (run >= kMinRun && run <= kMaxRun) {
+        hist[run]++;
+        n_runs++;
+      }
+      if (x < image_.cols) dark = !dark;
+      start = x;
+    }
+  }
+  for (x = 0; x < image_.cols; x += kLineStep) {
+    bool dark = image_.at<uchar>(0, x) < th;
+    int start = 0;
+    for (y = 1; y <= image_.rows; y++) {
+      if (y < image_.rows && (image_.at<uchar>(y, x) < th) == dark) continue;
+      int run = y - start;
+      if (run >= kMinRun && run <= kMaxRun) {
+        hist[run]++;
+        n_runs++;
+      }
+      if (y < image_.rows) dark = !dark;
+      start = y;
+    }
+  }
+  if (n_runs < kMinRunCount) return 0;
+
+  // blurred edges make a run 1px longer or shorter, so smooth the peak
+  int pitch = 0, max_votes = 0;
+  for (int run = kMinRun; run <= kMaxRun; run++) {
+    int votes = hist[run - 1] + hist[run] + hist[run + 1];
+    if (votes > max_votes) {
+      max_votes = votes;
+      pitch = run;
+    }
+  }
+  vector<int>().swap(hist);
+
+  int block = (int)floor(pitch * kBlockPerPitch + 0.5) | 1;
+  if (block < kMinBlock) block = kMinBlock;
+  if (block > kMaxBlock) block = kMaxBlock;
+  bin_adaptive_block_ = block;
+  module_pitch_ = pitch;
+
+  return pitch;
+}
+
 void ImageProcessor::Process(Mat* output_binarized,
-                             vector<PointSeq>* contours) {
+                             vector<PointSeq>* contours,
+                             BitImage* output_bits,
+                             vector<Rect>* output_bounds) {
   if (image_.empty()) return;
 
-  medianBlur(image_, image_, 3);
-  switch (bin_method_) {
-    case BIN_NORMAL:
-      BinarizeNormal();
-      break;
-    case BIN_ADAPTIVE:
-      BinarizeAdaptive();
-      break;
-    default:
-      break;
-  }
+  // binary_ may still be referenced by the last output, never write into it
+  binary_.release();
+  Mat shrunk, binarized;
+  Shrink(image_, &shrunk);
+  BinarizeShrunk(shrunk, &binarized);
+  shrunk.release();
+
+  Trace(binarized, contours, output_bits, output_bounds);
+  *output_binarized = binary_;
+}
 
-  GetContours(contours);
-  FilterContours(contours);
-  *output_binarized = image_.clone();
+void ImageProcessor::Trace(const Mat& binarized, vector<PointSeq>* contours,
+                           BitImage* output_bits, vector<Rect>* output_bounds) {
+  // findContours leaves the image untouched, so it is shared, not copied
+  binary_ = binarized;
+  vector<Vec4i> hierarchy;
+  GetContours(contours, &hierarchy);
+  FilterContours(contours, hierarchy, output_bounds);
+  if (output_bits != NULL) output_bits->Pack(binary_);
 
 #ifdef DEBUG_IMG_PROC
   namedWindow("Binarized", 1);
-  Mat drawing(image_.size(), CV_8UC3);
-  cvtColor(image_, drawing, COLOR_GRAY2RGB);
+  Mat drawing(binary_.size(), CV_8UC3);
+  cvtColor(binary_, drawing, COLOR_GRAY2RGB);
   for (size_contour i = 0; i < contours->size(); i++) {
     Scalar color = Scalar(0, 255, 0); // BGR
     drawContours(drawing, *contours, (int)i, color, 1);
@@ -75,54 +174,119 @@ void ImageProcessor::Process(Mat* output_binarized,
 #endif  // DEBUG_IMG_PROC
 }
 
-void ImageProcessor::BinarizeNormal() {
-  threshold(image_, image_, bin_normal_th_, 255,
-            !bin_reversed_ ? THRESH_BINARY_INV : THRESH_BINARY);
+void ImageProcessor::Binarize(const Mat& source, Mat* output) const {
+  Binarize(source, bin_adaptive_block_, output);
 }
 
-void ImageProcessor::BinarizeAdaptive() {
-  adaptiveThreshold(image_, image_, 255, ADAPTIVE_THRESH_MEAN_C,
-                    THRESH_BINARY_INV, bin_adaptive_block_, 0);
-  if (bin_reversed_) {
-    Reverse();
-  }
+void ImageProcessor::BinarizeShrunk(const Mat& shrunk, Mat* output) const {
+  Binarize(shrunk, ShrunkBlock(), output);
+}
+
+int ImageProcessor::context_rows() const {
+  // the median takes 1 row, the adaptive mean half a block
+  const int kMedianRows = 1;
+  if (bin_method_ != BIN_ADAPTIVE) return kMedianRows;
+  return ShrunkBlock() / 2 + kMedianRows;
 }
 
-void ImageProcessor::Reverse() {
-  uchar* p = image_.data;
-  for (size_contour i = 0; i < image_.cols * image_.rows; ++i) {
-    *p++ = 255 - *p;
+int ImageProcessor::ShrunkBlock() const {
+  // the block is in full resolution pixels, as EstimateModulePitch sets it
+  const int kMinBlock = 3;
+  int block = (bin_adaptive_block_ / pyramid_scale()) | 1;
+  return block < kMinBlock ? kMinBlock : block;
+}
+
+void ImageProcessor::Binarize(const Mat& source, const int block,
+                              Mat* output) const {
+  // the blurred image is the only buffer, thresholds run in place on it.
+  // THRESH_BINARY is the exact complement of THRESH_BINARY_INV, so reversed
+  // needs no extra pass
+  Mat blurred;
+  medianBlur(source, blurred, 3);
+  const int type = !bin_reversed_ ? THRESH_BINARY_INV : THRESH_BINARY;
+  switch (bin_method_) {
+    case BIN_NORMAL:
+      threshold(blurred, blurred, bin_normal_th_, 255, type);
+      break;
+    case BIN_ADAPTIVE:
+      adaptiveThreshold(blurred, blurred, 255, ADAPTIVE_THRESH_MEAN_C, type,
+                        block, 0);
+      break;
+    default:
+      break;
   }
+  if (output->data == source.data)
+    blurred.copyTo(*output);
+  else
+    *output = blurred;
 }
 
-void ImageProcessor::GetContours(vector<PointSeq>* contours) {
-  findContours(image_, *contours, RETR_LIST, CHAIN_APPROX_NONE, Point(0, 0));
+void ImageProcessor::GetContours(vector<PointSeq>* contours,
+                                 vector<Vec4i>* hierarchy) {
+  findContours(binary_, *contours, *hierarchy, RETR_TREE, CHAIN_APPROX_NONE,
+               Point(0, 0));
 }
 
 /**
- @brief check each contours by CheckContour, if not OK remove it
- @param contours - output with some contours removed
+ @brief check each contours by CheckContour, if not OK remove it. the rest
+        are ordered by priority: the outer ones first(a datamatrix is outside
+        of its elements and the holes in it), then the larger ones first
+ @param contours  - output with some contours removed
+ @param hierarchy - of the contours, by findContours
+ @param bounds    - optional, output the bounding rect of each contour
 **/
-void ImageProcessor::FilterContours(vector<PointSeq>* contours) {
-  vector<PointSeq> filtered_contours;
-  for (PointSeq contour : *contours) {
-    if (CheckContour(contour)) {
-      filtered_contours.push_back(contour);
+void ImageProcessor::FilterContours(vector<PointSeq>* contours,
+                                    const vector<Vec4i>& hierarchy,
+                                    vector<Rect>* bounds) {
+  const int n_contours = (int)contours->size();
+  // depth in the hierarchy, -1: not known yet
+  vector<int> depths(n_contours, -1);
+  vector<int> chain;
+  for (int i = 0; i < n_contours; i++) {
+    int j = i;
+    while (j >= 0 && depths[j] == -1) {
+      chain.push_back(j);
+      j = hierarchy[j][3];  // parent
     }
+    int depth = j >= 0 ? depths[j] : -1;
+    while (!chain.empty()) {
+      depths[chain.back()] = ++depth;
+      chain.pop_back();
+    }
+  }
+
+  vector<int> kept;
+  vector<Rect> boundings(n_contours);
+  for (int i = 0; i < n_contours; i++) {
+    if (CheckContour((*contours)[i], &boundings[i])) kept.push_back(i);
+  }
+  std::stable_sort(kept.begin(), kept.end(), [&](int a, int b) {
+    if (depths[a] != depths[b]) return depths[a] < depths[b];
+    return boundings[a].area() > boundings[b].area();
+  });
+
+  vector<PointSeq> filtered_contours(kept.size());
+  if (bounds != NULL) bounds->resize(kept.size());
+  for (size_t k = 0; k < kept.size(); k++) {
+    filtered_contours[k].swap((*contours)[kept[k]]);
+    if (bounds != NULL) (*bounds)[k] = boundings[kept[k]];
   }
   contours->swap(filtered_contours);
 }
 /**
  @brief  check contour using 3 conditions
  @param  contour
+ @param  bound - output the rect just bound the contour
  @retval true: if all the requirements are met
 **/
-bool ImageProcessor::CheckContour(const PointSeq& contour) {
-  // the amount of points that forms the contour should > kMin4PointCnt
-  if (contour.size() < kMin4PointCnt) return false;
+bool ImageProcessor::CheckContour(const PointSeq& contour, Rect* bound) {
+  // the amount of points that forms the contour should > the min point count
+  const size_t min_points = (size_t)(4 * kMinElementsPerSide * min_module_);
+  if (contour.size() < min_points) return false;
 
   // the rect(hori & verti) just bound the contour
   Rect bounding = boundingRect(contour);
+  *bound = bounding;
   float aspect = bounding.height < bounding.width
                      ? (float)bounding.height / bounding.width
                      : (float)bounding.width / bounding.height;
@@ -131,8 +295,8 @@ bool ImageProcessor::CheckContour(const PointSeq& contour) {
 
   // --
   if (bounding.x < kMin4Gap2Edge || bounding.y < kMin4Gap2Edge) return false;
-  if (bounding.x + bounding.width + kMin4Gap2Edge > image_.cols ||
-      bounding.y + bounding.height + kMin4Gap2Edge > image_.rows)
+  if (bounding.x + bounding.width + kMin4Gap2Edge > binary_.cols ||
+      bounding.y + bounding.height + kMin4Gap2Edge > binary_.rows)
     return false;
 
   return true;
@@ -13,6 +13,8 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "bit_image.h"
+
 namespace hyf_lemon {
 
 /**
@@ -37,7 +39,10 @@ enum BinMethod {
            backgroud is bright, otherwise "true" should be set to converse it),
            bin_method <- BIN_ADAPTIVE,
            bin_adaptive_block <- 25,
-           bin_nornal_th <- 127
+           bin_adaptive_auto <- false (true: bin_adaptive_block is chosen by
+           EstimateModulePitch),
+           bin_nornal_th <- 127,
+           pyramid_level <- 0 (binarize and find contours at full resolution)
 **/
 class ImageProcessor {
  public:
@@ -55,9 +60,42 @@ class ImageProcessor {
              attention: must set_image(Mat) or construct with
              ImageProcessor(Mat) beforehead
     @param
-             contours - output all the contours
+             contours - output all the contours, by priority
+             output_bits - optional, output the binarized image packed to
+             1 bit per pixel for the line scans of locator
+             output_bounds - optional, output the bounding rect of each
+             contour
+  **/
+  void Process(cv::Mat* output_binarized, std::vector<PointSeq>* contours,
+               BitImage* output_bits = NULL,
+               std::vector<cv::Rect>* output_bounds = NULL);
+  /**
+    @brief   binarize only, the same way as Process but at full resolution and
+             without contours. image is not used, for the re-binarizations
+             of an image warped or painted by the locator/reader
+    @param   source - gray image, untouched unless output shares it
+             output - binarized, may be the source itself(in place)
+  **/
+  void Binarize(const cv::Mat& source, cv::Mat* output) const;
+  /**
+    @brief   binarize an image already downsampled to the pyramid level, as
+             Process does(the adaptive block is scaled)
+  **/
+  void BinarizeShrunk(const cv::Mat& shrunk, cv::Mat* output) const;
+  /**
+    @brief   rows above and below a pixel that its binarization reads, at
+             the pyramid level. a band binarized alone is exact but for this
+             many rows at each end
   **/
-  void Process(cv::Mat* output_binarized, std::vector<PointSeq>* contours);
+  int context_rows() const;
+  /**
+    @brief   the contour part of Process, on an image binarized by the caller
+             at the pyramid level(eg. band by band). the parameters are those
+             of Process
+  **/
+  void Trace(const cv::Mat& binarized, std::vector<PointSeq>* contours,
+             BitImage* output_bits = NULL,
+             std::vector<cv::Rect>* output_bounds = NULL);
 
   // setter & getter
   cv::Mat image() const { return image_; }
@@ -73,26 +111,82 @@ class ImageProcessor {
   void set_bin_normal_th(const unsigned val) { bin_normal_th_ = val; }
 
   unsigned bin_adaptive_block() const { return bin_adaptive_block_; }
+  /**
+    @brief in full resolution pixels, Process scales it to the pyramid level
+  **/
   void set_bin_adaptive_block(const unsigned val) { bin_adaptive_block_ = val; }
 
+  bool bin_adaptive_auto() const { return bin_adaptive_auto_; }
+  void set_bin_adaptive_auto(const bool val) { bin_adaptive_auto_ = val; }
+
+  /**
+    @brief  estimate the dominant module(element) pitch of the source image
+            from run-length statistics, then set bin_adaptive_block by it.
+            the result is kept in module_pitch until reset to 0
+    @retval the pitch in pixels, 0 if it can not be estimated(block unchanged)
+  **/
+  int EstimateModulePitch();
+  int module_pitch() const { return module_pitch_; }
+  void set_module_pitch(const int val) { module_pitch_ = val; }
+
+  int min_module() const { return min_module_; }
+  /**
+    @brief the min size(px) of a datamatrix element that can be located,
+           default 4. a contour needs 4 sides of 10 elements at least
+  **/
+  void set_min_module(const int val) { min_module_ = val > 1 ? val : 1; }
+
+  unsigned pyramid_level() const { return pyramid_level_; }
+  void set_pyramid_level(const unsigned val);
+  /**
+    @brief pick the pyramid level from the expected module size, so that a
+           module is still >= min_module pixels after downsampling
+    @param val - expected module size in pixels (full resolution)
+  **/
+  void set_expected_module(const unsigned val);
+  /**
+    @brief  how many full resolution pixels one pixel of the binarized output
+            (and the contours) stands for
+  **/
+  int pyramid_scale() const { return 1 << pyramid_level_; }
+  /**
+    @brief downsample an image to the pyramid level, if pyramid_level is 0
+           output shares the data with source
+  **/
+  void Shrink(const cv::Mat& source, cv::Mat* output) const;
+
  private:
   void Initialize();
-  void BinarizeNormal();
-  void BinarizeAdaptive();
-  void Reverse();
-  void GetContours(std::vector<PointSeq>* contours);
-  void FilterContours(std::vector<PointSeq>* contours);
-  bool CheckContour(const PointSeq& conour);
+  void Binarize(const cv::Mat& source, const int block, cv::Mat* output) const;
+  /**
+    @brief bin_adaptive_block scaled to the pyramid level, odd and >= 3
+  **/
+  int ShrunkBlock() const;
+  void GetContours(std::vector<PointSeq>* contours,
+                   std::vector<cv::Vec4i>* hierarchy);
+  void FilterContours(std::vector<PointSeq>* contours,
+                      const std::vector<cv::Vec4i>& hierarchy,
+                      std::vector<cv::Rect>* bounds);
+  bool CheckContour(const PointSeq& conour, cv::Rect* bound);
 
  private:
   cv::Mat image_;
+  // working image of Process, image_ is kept untouched for the next take
+  cv::Mat binary_;
   bool bin_reversed_;
   BinMethod bin_method_;
   int bin_normal_th_;
   int bin_adaptive_block_;
-  // the min point count : each element > 4pix, each side has a minimum of 10
-  // elememts, 4 sides in total
-  const int kMin4PointCnt = 4 * 10 * 4;
+  bool bin_adaptive_auto_;
+  int module_pitch_;
+  unsigned pyramid_level_;
+  // the min size of a datamatrix element (module) that can be located
+  int min_module_;
+  // 1/4 of full resolution at most
+  const unsigned kMaxPyramidLevel = 2;
+  // the min point count : min_module_ each element, each side has a minimum
+  // of 10 elememts, 4 sides in total
+  const int kMinElementsPerSide = 10;
   // the threshold of the aspect ratio of a datamatrix
   const float kTh4Aspect = 0.20f;
   // the min of the distances between a datamatrix and image's edges
@@ -12,6 +12,9 @@
 
 #include "lemon_api.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <iostream>
 
 using std::cout;
@@ -49,11 +52,21 @@ bool Decode_rt(const int width, const int height, const uchar* image_data,
  *                                   class                                   *
  ****************************************************************************/
 
-Lemon::Lemon() {}
+Lemon::Lemon() {
+  memory_limit_ = 0;
+  tile_overlap_ = 256;
+  read_method_ = READ_GRID;
+  threads_ = 0;
+  expected_count_ = 0;
+  time_budget_ = 0.0;
+  decode_begin_ = 0;
+  gradient_detect_ = false;
+  stats_.assign(5, RejectStats());
+}
 Lemon::~Lemon() { image_.release(); }
 
 void Lemon::SetImage(const Mat& image) {
-  processor_.set_image(image);
+  // processor_ copies the image(or each tile of it) right before decoding
   image_ = image;
 }
 void Lemon::SetReversed(const bool reversed) {
@@ -68,16 +81,168 @@ void Lemon::SetBinNormalTh(const unsigned val) {
 void Lemon::SetBinAdaptiveBlock(const unsigned val) {
   processor_.set_bin_adaptive_block(val);
 }
+void Lemon::SetBinAdaptiveAuto(const bool val) {
+  processor_.set_bin_adaptive_auto(val);
+  processor_.set_module_pitch(0);
+}
+void Lemon::SetPyramidLevel(const unsigned val) {
+  processor_.set_pyramid_level(val);
+}
+void Lemon::SetExpectedModule(const unsigned val) {
+  processor_.set_expected_module(val);
+}
+void Lemon::SetMinModule(const unsigned val) {
+  processor_.set_min_module((int)val);
+  locator_.set_min_module((int)val);
+}
+bool Lemon::SetMemoryLimit(const size_t bytes) {
+  if (bytes > 0 && bytes < (size_t)kMinTile * kMinTile * kBytesPerPixel)
+    return false;
+  memory_limit_ = bytes;
+  return true;
+}
+void Lemon::SetTileOverlap(const int val) { tile_overlap_ = val; }
+void Lemon::SetReadMethod(const ReadMethod method) { read_method_ = method; }
+void Lemon::SetSupersample(const int val) { reader_.set_supersample(val); }
+void Lemon::SetSubpixel(const bool val) { locator_.set_subpixel(val); }
+void Lemon::SetSimplify(const double val) { locator_.set_simplify(val); }
+void Lemon::SetExpectedCount(const int val) { expected_count_ = val; }
+void Lemon::SetTimeBudget(const double ms) { time_budget_ = ms; }
+void Lemon::SetGradientDetect(const bool val) { gradient_detect_ = val; }
+bool Lemon::SetCamera(const Mat& camera_matrix, const Mat& dist_coeffs) {
+  bool valid = true;
+  if (camera_matrix.empty())
+    lens_.Reset();
+  else
+    valid = lens_.Set(camera_matrix, dist_coeffs);
+  locator_.set_lens(lens_);
+  reader_.set_lens(lens_);
+  return valid;
+}
+void Lemon::SetThreads(const int val) {
+  threads_ = val;
+  locator_.set_threads(val);
+  if (val > 0) setNumThreads(val);
+}
 
-bool Lemon::Decode(vector<vector<uchar>>* output) {
+bool Lemon::Decode(vector<vector<uchar>>* output, vector<Rect>* regions) {
 
 #ifdef DEBUG_MAIN
   double time_begin = getTickCount();
 #endif  // DEBUG_MAIN
 
+  decode_begin_ = getTickCount();
+  stats_.assign(5, RejectStats());
+  bool flag_success = false;
+  if (memory_limit_ > 0 && image_.total() * kBytesPerPixel > memory_limit_)
+    flag_success = DecodeTiled(output, regions);
+  else
+    flag_success = DecodeFrame(image_, output, regions);
+  // estimate again for the next image
+  if (!flag_success && processor_.bin_adaptive_auto())
+    processor_.set_module_pitch(0);
+
+#ifdef DEBUG_MAIN
+  double time_end = getTickCount();
+  cout << "time spend: " << (time_end - time_begin) * 1000 / getTickFrequency()
+       << "ms" << endl;
+#endif  // DEBUG_MAIN
+
+  return flag_success;
+}
+
+bool Lemon::DecodeTiled(vector<vector<uchar>>* output, vector<Rect>* regions) {
+  /* square tiles, neighbours overlap by tile_overlap_ so that each datamatrix
+   * is complete in at least one tile. results found again in an overlap are
+   * dropped by their regions. */
+  // not below kMinTile, see SetMemoryLimit
+  const int tile = std::max(
+      (int)sqrt((double)memory_limit_ / kBytesPerPixel), kMinTile);
+  // the limit is kept: a small tile overlaps by half of it at most, then a
+  // datamatrix larger than the overlap may be cut in every tile
+  const int overlap = std::min(tile_overlap_, tile / 2);
+  const int step = tile - overlap;
+
+  vector<Rect> found;
+  bool flag_success = false;
+  for (int y = 0; y < image_.rows; y += step) {
+    int y0 = y + tile < image_.rows ? y : std::max(image_.rows - tile, 0);
+    for (int x = 0; x < image_.cols; x += step) {
+      int x0 = x + tile < image_.cols ? x : std::max(image_.cols - tile, 0);
+      Rect roi = Rect(x0, y0, tile, tile) & Rect(0, 0, image_.cols, image_.rows);
+
+#ifdef DEBUG_MAIN
+      cout << ">>>>>>  Tile " << roi.x << ", " << roi.y << endl;
+#endif  // DEBUG_MAIN
+      vector<vector<uchar>> texts;
+      vector<Rect> bounds;
+      // the lens is calibrated on the whole image
+      LensModel tile_lens = lens_;
+      tile_lens.set_offset(Point2d(roi.x, roi.y));
+      locator_.set_lens(tile_lens);
+      reader_.set_lens(tile_lens);
+      // the takes change the settings: kept if decoded, otherwise restored so
+      // that the next tile starts from the same ones
+      const bool reversed = processor_.bin_reversed();
+      const BinMethod method = processor_.bin_method();
+      const int block = processor_.bin_adaptive_block();
+      if (!DecodeFrame(image_(roi), &texts, &bounds)) {
+        SetReversed(reversed);
+        SetBinMethod(method);
+        SetBinAdaptiveBlock(block);
+      }
+      for (size_t i = 0; i < texts.size(); i++) {
+        Rect bound = bounds[i] + roi.tl();
+        bool is_new = true;
+        for (Rect region : found) {
+          if ((region & bound).area() > 0) {
+            is_new = false;
+            break;
+          }
+        }
+        if (!is_new) continue;
+        found.push_back(bound);
+        output->push_back(texts[i]);
+        if (regions != NULL) regions->push_back(bound);
+        flag_success = true;
+      }
+      if (x0 + tile >= image_.cols || IsDone(*output)) break;
+    }
+    if (y0 + tile >= image_.rows || IsDone(*output)) break;
+  }
+  processor_.set_image(Mat());
+  locator_.set_lens(lens_);
+  reader_.set_lens(lens_);
+  return flag_success;
+}
+
+bool Lemon::DecodeFrame(const Mat& image, vector<vector<uchar>>* output,
+                        vector<Rect>* regions) {
+  processor_.set_image(image);
+
+  // the block size is estimated once, then remembered for following frames
+  // until a frame fails
+  const bool auto_block = processor_.bin_adaptive_auto();
+  if (auto_block && processor_.module_pitch() == 0) {
+    processor_.EstimateModulePitch();
+#ifdef DEBUG_MAIN
+    cout << "Module pitch: " << processor_.module_pitch()
+         << ", adaptive block: " << processor_.bin_adaptive_block() << endl;
+#endif  // DEBUG_MAIN
+  }
+
   bool flag_success = false;
+  // regions decoded in this frame, candidates overlapping them are skipped
+  vector<Rect> decoded_bounds;
+  if (gradient_detect_ && !IsDone(*output)) {
+    const int64_t gradient_begin = getTickCount();
+    flag_success = DecodeGradient(image, &decoded_bounds, output, regions);
+    stats_[0].ms +=
+        (getTickCount() - gradient_begin) * 1000.0 / getTickFrequency();
+  }
   int n_takes = 0;
-  while (!flag_success && n_takes < 4) {
+  // the first take still runs after the gradient pass, for what it missed
+  while ((n_takes == 0 || !flag_success) && n_takes < 4 && !IsDone(*output)) {
     switch (n_takes++) {
       case 0:
         // default or last successful method
@@ -86,6 +251,8 @@ bool Lemon::Decode(vector<vector<uchar>>* output) {
         SetReversed(true);
         break;
       case 2:
+        // the estimated block is already the informed one, no guess needed
+        if (auto_block) continue;
         SetReversed(false);
         SetBinAdaptiveBlock(35);
         break;
@@ -101,105 +268,421 @@ bool Lemon::Decode(vector<vector<uchar>>* output) {
     cout << ">>>  Take " << n_takes << endl;
 #endif  // DEBUG_MAIN
 
-    /* ****************************  step 1  *********************************/
-    Mat binarized;
-    vector<PointSeq> contours;
-    processor_.Process(&binarized, &contours);
-    if (contours.size() < 1) {
-#ifdef DEBUG_MAIN
-      cout << "Step 1 - Image Process: No possible contours found." << endl;
-#endif  // DEBUG_MAIN
+    const size_t n_decoded = decoded_bounds.size();
+    DecodeTake(image, NULL, &decoded_bounds, output, regions,
+               &stats_[n_takes]);
+    if (decoded_bounds.size() > n_decoded) flag_success = true;
+  }  // while
 
-      binarized.release();
-      vector<PointSeq>().swap(contours);
-      continue;
-    }
+  return flag_success;
+}
+
+int Lemon::DecodeTake(const Mat& image, const Mat* binarized_given,
+                      vector<Rect>* decoded_bounds,
+                      vector<vector<uchar>>* output, vector<Rect>* regions,
+                      RejectStats* stats, vector<Rect>* missed) {
+  const int64_t take_begin = getTickCount();
+  RejectStats& take_stats = *stats;
+
+  /* ****************************  step 1  *********************************/
+  Mat binarized;
+  vector<PointSeq> contours;
+  BitImage bits;
+  vector<Rect> contour_bounds;
+  if (binarized_given != NULL) {
+    binarized = *binarized_given;
+    processor_.Trace(binarized, &contours, &bits, &contour_bounds);
+  } else
+    processor_.Process(&binarized, &contours, &bits, &contour_bounds);
+  if (contours.size() < 1) {
 #ifdef DEBUG_MAIN
-    cout << "Step 1 - Image Process: " << contours.size() << " possible contours found."
-         << endl;
+    cout << "Step 1 - Image Process: No possible contours found." << endl;
 #endif  // DEBUG_MAIN
 
-    /* ****************************  step 2  *********************************/
-    locator_.set_image(binarized);
-    locator_.set_contours(contours);
-    MatVec datamatrixs;
-    int count = locator_.LocateDatamatrix(image(), processor_, &datamatrixs);
-    if (count < 1) {
+    binarized.release();
+    vector<PointSeq>().swap(contours);
+    take_stats.ms +=
+        (getTickCount() - take_begin) * 1000.0 / getTickFrequency();
+    return 0;
+  }
 #ifdef DEBUG_MAIN
-      cout << "Step 2 - Datamatrix Locator: No possible Datamatrix found." << endl;
+  cout << "Step 1 - Image Process: " << contours.size() << " possible contours found."
+       << endl;
 #endif  // DEBUG_MAIN
 
-      binarized.release();
-      vector<PointSeq>().swap(contours);
-      MatVec().swap(datamatrixs);
-      continue;
-    }
+  /* **************************  step 2 & 3  *******************************/
+  /* the contours are scored cheaply, then located, read and decoded best
+   * first(see DecodeCandidates). */
+  locator_.set_image(binarized, bits);
+  locator_.set_contours(contours);
+  vector<double> scores;
+  locator_.ScoreContours(&scores);
+  vector<int> order;
+  for (int i = 0; i < (int)contours.size(); i++)
+    if (scores[i] > 0.0) order.push_back(i);
+  // a contour scored 0 has no L shape
+  take_stats.candidates += (int)(contours.size() - order.size());
+  take_stats.rejects[REJECT_L_SHAPE] +=
+      (int)(contours.size() - order.size());
+  // equal scores keep the order of the hierarchy
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int a, int b) { return scores[a] > scores[b]; });
+
+  const size_t n_decoded = decoded_bounds->size();
+  int count = DecodeCandidates(image, order, contour_bounds, NULL, NULL,
+                               decoded_bounds, output, regions,
+                               &take_stats, missed);
 #ifdef DEBUG_MAIN
-    cout << "Step 2 - Datamatrix Locator: " << count << " possible Datamatrix found."
-         << endl;
+  cout << "Step 2 - Datamatrix Locator: " << count
+       << " possible Datamatrix found, "
+       << decoded_bounds->size() - n_decoded << " decoded." << endl;
+  cout << "Rejected:";
+  for (int r = 0; r < REJECT_REASONS; r++) {
+    if (take_stats.rejects[r] > 0)
+      cout << " " << RejectName((RejectReason)r) << " "
+           << take_stats.rejects[r];
+  }
+  cout << endl;
 #endif  // DEBUG_MAIN
 
-    /* ****************************  step 3  *********************************/
-    for (Mat datamatrix : datamatrixs) {
-      reader_.set_image(datamatrix);
-      // read
-      vector<int> codes;
-      int size_hori = reader_.Read(processor_, &codes);
-      int size_vert = codes.size() / size_hori;
-      if (size_hori < 8 || size_vert < 8) continue;
-      if (size_hori % 2 == 1 || size_vert % 2 == 1) continue;
+  binarized.release();
+  vector<PointSeq>().swap(contours);
+  take_stats.ms += (getTickCount() - take_begin) * 1000.0 / getTickFrequency();
+  return count;
+}
 
+int Lemon::DecodeBinarized(const Mat& image, const Mat& binarized,
+                           vector<vector<uchar>>* output,
+                           vector<Rect>* regions, vector<Rect>* missed) {
+  decode_begin_ = getTickCount();
+  stats_.assign(5, RejectStats());
+  vector<Rect> decoded_bounds;
+  return DecodeTake(image, &binarized, &decoded_bounds, output, regions,
+                    &stats_[1], missed);
+}
+
+bool Lemon::DecodeGradient(const Mat& image, vector<Rect>* decoded_bounds,
+                           vector<vector<uchar>>* output,
+                           vector<Rect>* regions) {
+  /* the L shapes are found on the gray image, so the binarization takes are
+   * not needed, only the polarity is: the current one first, then the other.
+   * like a take, the polarity decoded is kept, otherwise the one on entry is
+   * restored(the time may run out before the second pass). */
+  const bool reversed = processor_.bin_reversed();
+  Mat gray;
+  processor_.Shrink(image, &gray);
+  for (int pass = 0; pass < 2 && !IsDone(*output); pass++) {
+    if (pass == 1) SetReversed(!reversed);
+    vector<LShape> l_shapes;
+    vector<Rect> shape_bounds;
+    detector_.Detect(gray, processor_.bin_reversed(), &l_shapes,
+                     &shape_bounds);
+    // already best first
+    vector<int> order(l_shapes.size());
+    for (int i = 0; i < (int)order.size(); i++) order[i] = i;
+    const size_t n_decoded = decoded_bounds->size();
+    int count = DecodeCandidates(image, order, shape_bounds, &gray, &l_shapes,
+                                 decoded_bounds, output, regions, &stats_[0]);
 #ifdef DEBUG_MAIN
-      cout << "Step 3 - Datamatrix Reader: " << endl;
-      for (int j = 0; j < size_vert; j++) {
-        for (int i = 0; i < size_hori; i++) {
-          int idx = size_hori * j + i;
-          cout << codes[idx] << " ";
+    cout << "Gradient - " << l_shapes.size() << " L shapes, " << count
+         << " possible Datamatrix found, "
+         << decoded_bounds->size() - n_decoded << " decoded." << endl;
+#endif  // DEBUG_MAIN
+    if (decoded_bounds->size() > n_decoded) return true;
+  }
+  SetReversed(reversed);
+  return false;
+}
+
+int Lemon::DecodeCandidates(const Mat& image, const vector<int>& order,
+                            const vector<Rect>& candidate_bounds,
+                            const Mat* gray, const vector<LShape>* l_shapes,
+                            vector<Rect>* decoded_bounds,
+                            vector<vector<uchar>>* output,
+                            vector<Rect>* regions, RejectStats* stats,
+                            vector<Rect>* missed) {
+  /* the candidates are located, read and decoded best first, wave by
+   * wave(a wave for each thread). a candidate overlapping a datamatrix
+   * decoded in an earlier wave is part of it, so it is skipped. it stops
+   * once the expected count is decoded or the time is out. */
+  const bool sample = read_method_ == READ_SAMPLE;
+  const int scale = processor_.pyramid_scale();
+  const size_t wave = threads_ == 1 ? 1 : std::max(getNumThreads(), 1);
+  int count = 0;
+  size_t next = 0;
+  locator_.ResetStats();
+  while (next < order.size() && !IsDone(*output)) {
+    vector<int> indices;
+    for (; next < order.size() && indices.size() < wave; next++) {
+      const Rect& b = candidate_bounds[order[next]];
+      Rect bound(b.x * scale, b.y * scale, b.width * scale, b.height * scale);
+      bool is_decoded = false;
+      for (const Rect& decoded_bound : *decoded_bounds) {
+        if ((decoded_bound & bound).area() > 0) {
+          is_decoded = true;
+          break;
         }
-        cout << endl;
       }
+      if (!is_decoded)
+        indices.push_back(order[next]);
+      else
+        stats->skipped++;
+    }
+    if (indices.empty()) break;
+
+    MatVec datamatrixs, homographies;
+    vector<Rect> bounds;
+    if (l_shapes != NULL)
+      count += locator_.LocateLShapes(image, *gray, processor_, *l_shapes,
+                                      &datamatrixs, &bounds,
+                                      sample ? &homographies : NULL, &indices);
+    else
+      count += locator_.LocateDatamatrix(image, processor_, &datamatrixs,
+                                         &bounds,
+                                         sample ? &homographies : NULL,
+                                         &indices);
+
+    // candidates are read and decoded in parallel, each into its own slot,
+    // then output in the order they are located
+    const int n_candidates = (int)bounds.size();
+    const MatVec& inputs = sample ? homographies : datamatrixs;
+    vector<vector<uchar>> texts(n_candidates);
+    vector<uchar> decoded(n_candidates, 0);
+    vector<RejectReason> rejects(n_candidates, REJECT_NONE);
+    if (threads_ == 1 || n_candidates < 2) {
+      for (int n = 0; n < n_candidates; n++)
+        decoded[n] = ReadCandidate(image, inputs[n], sample, &texts[n],
+                                   &rejects[n]);
+    } else {
+      parallel_for_(Range(0, n_candidates), [&](const Range& range) {
+        for (int n = range.start; n < range.end; n++)
+          decoded[n] = ReadCandidate(image, inputs[n], sample, &texts[n],
+                                     &rejects[n]);
+      }, n_candidates);
+    }
+    for (int n = 0; n < n_candidates; n++) {
+      if (!decoded[n]) {
+        stats->Count(rejects[n]);
+        if (missed != NULL) missed->push_back(bounds[n]);
+        continue;
+      }
+      stats->decoded++;
+      output->push_back(texts[n]);
+      decoded_bounds->push_back(bounds[n]);
+      if (regions != NULL) regions->push_back(bounds[n]);
+    }
+  }
+  stats->Add(locator_.stats());
+  return count;
+}
+
+bool Lemon::IsDone(const vector<vector<uchar>>& output) const {
+  if (expected_count_ > 0 && (int)output.size() >= expected_count_)
+    return true;
+  if (time_budget_ > 0.0) {
+    double spent =
+        (getTickCount() - decode_begin_) * 1000.0 / getTickFrequency();
+    if (spent > time_budget_) return true;
+  }
+  return false;
+}
+
+bool Lemon::ReadCandidate(const Mat& image, const Mat& candidate,
+                          const bool sample, vector<uchar>* text,
+                          RejectReason* reject) const {
+  // a copy for each candidate, so that candidates can be read in parallel
+  DatamatrixReader reader = reader_;
+  // read
+  vector<int> codes;
+  int size_hori = -1;
+  if (sample) {
+    size_hori = reader.Sample(processor_, image, candidate, &codes);
+  } else {
+    reader.set_image(candidate);
+    size_hori = reader.Read(processor_, &codes);
+  }
+  if (size_hori < 0) {
+    *reject = reader.reject();
+    return false;
+  }
+  *reject = REJECT_GRID;
+  if (size_hori < 8) return false;
+  int size_vert = codes.size() / size_hori;
+  if (size_vert < 8) return false;
+  if (size_hori % 2 == 1 || size_vert % 2 == 1) return false;
+  *reject = REJECT_NONE;
+
+#ifdef DEBUG_MAIN
+  cout << "Step 3 - Datamatrix Reader: " << endl;
+  for (int j = 0; j < size_vert; j++) {
+    for (int i = 0; i < size_hori; i++) {
+      int idx = size_hori * j + i;
+      cout << codes[idx] << " ";
+    }
+    cout << endl;
+  }
 #endif
 
-      // decode
-      DatamatrixDecoder decoder(size_vert, size_hori, codes);
-      vector<int> message;
-      vector<uchar> text;
-      if (decoder.decode(&message)) {
-        flag_success = true;
+  // decode
+  DatamatrixDecoder decoder(size_vert, size_hori, codes);
+  vector<int> message;
+  if (!decoder.decode(&message)) {
+    *reject = decoder.reject();
+    return false;
+  }
 
 #ifdef DEBUG_MAIN
-        cout << "Step 4 - Decode Result: ";
+  cout << "Step 4 - Decode Result: ";
 #endif
-        for (int i = 0; i < message.size(); i++) {
-          uchar c = (uchar)message[i];
-          text.push_back(c);
+  for (int i = 0; i < message.size(); i++) {
+    uchar c = (uchar)message[i];
+    text->push_back(c);
 
 #ifdef DEBUG_MAIN
-          cout << c;
+    cout << c;
 #endif
-        }
-        output->push_back(text);
+  }
 #ifdef DEBUG_MAIN
-        cout << endl;
+  cout << endl;
 #endif
-      }
-      vector<int>().swap(codes);
-      vector<int>().swap(message);
-    }  // for(step 3)
+  return true;
+}
 
-    binarized.release();
-    vector<PointSeq>().swap(contours);
-    MatVec().swap(datamatrixs);
+/****************************************************************************
+ *                                  stream                                  *
+ ****************************************************************************/
 
-  }  // while
+LemonStream::LemonStream(const int width, const int max_symbol_rows,
+                         const int band_rows) {
+  // a band is shrunk alone, so it starts at a whole pixel of any level
+  const int kRowAlign = 4;
+  overlap_rows_ = (max_symbol_rows + kRowAlign - 1) / kRowAlign * kRowAlign;
+  band_rows_ = (band_rows + kRowAlign - 1) / kRowAlign * kRowAlign;
+  window_ = Mat::zeros(overlap_rows_ + band_rows_, width, CV_8UC1);
+  filled_ = decoded_rows_ = binarized_rows_ = 0;
+  binary_scale_ = 0;
+}
+LemonStream::~LemonStream() {
+  window_.release();
+  binary_.release();
+  vector<Rect>().swap(decoded_);
+}
 
-#ifdef DEBUG_MAIN
-  double time_end = getTickCount();
-  cout << "time spend: " << (time_end - time_begin) * 1000 / getTickFrequency()
-       << "ms" << endl;
-#endif  // DEBUG_MAIN
+void LemonStream::Reset() {
+  filled_ = decoded_rows_ = binarized_rows_ = 0;
+  decoded_.clear();
+}
 
-  return flag_success;
+int LemonStream::PushRows(const uchar* ptr, const int n_rows,
+                          const int stride, vector<vector<uchar>>* output) {
+  int n_results = 0;
+  for (int i = 0; i < n_rows; i++) {
+    memcpy(window_.ptr<uchar>(filled_++), ptr + (size_t)i * stride,
+           window_.cols);
+    if (filled_ < window_.rows) continue;
+
+    // the window is full: decode it, then keep the last overlap_rows_ rows
+    n_results += DecodeWindow(output, false);
+    memmove(window_.ptr<uchar>(0), window_.ptr<uchar>(band_rows_),
+            (size_t)overlap_rows_ * window_.step);
+    filled_ = decoded_rows_ = overlap_rows_;
+    if (binarized_rows_ > 0) {
+      const int scale = binary_scale_;
+      memmove(binary_.ptr<uchar>(0), binary_.ptr<uchar>(band_rows_ / scale),
+              (size_t)(overlap_rows_ / scale) * binary_.step);
+      binarized_rows_ = std::max(binarized_rows_ - band_rows_, 0);
+    }
+    vector<Rect> kept;
+    for (Rect region : decoded_) {
+      region.y -= band_rows_;
+      if (region.y + region.height > 0) kept.push_back(region);
+    }
+    decoded_.swap(kept);
+  }
+  return n_results;
+}
+
+int LemonStream::Flush(vector<vector<uchar>>* output) {
+  int n_results = 0;
+  if (filled_ > decoded_rows_) n_results = DecodeWindow(output, true);
+  Reset();
+  return n_results;
+}
+
+int LemonStream::BinarizeRows() {
+  const ImageProcessor& processor = lemon_.processor();
+  const int scale = processor.pyramid_scale();
+  if (scale != binary_scale_) {
+    binary_.release();
+    binary_scale_ = scale;
+    binarized_rows_ = 0;
+  }
+  // whole pyramid pixels, the rows past filled_ repeat the last one
+  const int end = (filled_ + scale - 1) / scale * scale;
+  for (int y = filled_; y < end; y++)
+    memcpy(window_.ptr<uchar>(y), window_.ptr<uchar>(filled_ - 1),
+           window_.cols);
+
+  /* the rows written need context rows above them, the last context rows
+   * written before lacked the rows below, so they are written again. */
+  const int context = processor.context_rows();
+  const int out_begin = std::max(binarized_rows_ / scale - context, 0);
+  const int in_begin = std::max(out_begin - context, 0);
+  Mat shrunk, band;
+  processor.Shrink(window_.rowRange(in_begin * scale, end), &shrunk);
+  processor.BinarizeShrunk(shrunk, &band);
+  if (binary_.empty())
+    binary_ = Mat::zeros(window_.rows / scale, band.cols, CV_8UC1);
+  Mat rows_out = binary_.rowRange(out_begin, end / scale);
+  band.rowRange(out_begin - in_begin, band.rows).copyTo(rows_out);
+  binarized_rows_ = end;
+  return end;
+}
+
+int LemonStream::DecodeWindow(vector<vector<uchar>>* output,
+                              const bool last) {
+  // px, a candidate this close to the window bottom may be cut by it
+  const int kBottomGap = 4;
+  vector<vector<uchar>> texts;
+  vector<Rect> regions, missed;
+  const int rows = BinarizeRows();
+  const Mat image = window_.rowRange(0, rows);
+  lemon_.DecodeBinarized(image, binary_.rowRange(0, rows / binary_scale_),
+                         &texts, &regions, &missed);
+  // one cut by the bottom is complete in a later window, no takes for it
+  bool whole = false;
+  for (const Rect& bound : missed)
+    whole |= last || bound.y + bound.height < filled_ - kBottomGap;
+  if (texts.empty() && whole) {
+    // the other takes may read it. they change the settings: kept if
+    // decoded(then the window is binarized again), otherwise restored
+    const ImageProcessor settings = lemon_.processor();
+    lemon_.SetImage(image);
+    if (lemon_.Decode(&texts, &regions)) {
+      binarized_rows_ = 0;
+    } else {
+      lemon_.SetReversed(settings.bin_reversed());
+      lemon_.SetBinMethod(settings.bin_method());
+      lemon_.SetBinAdaptiveBlock(settings.bin_adaptive_block());
+    }
+  }
+  decoded_rows_ = filled_;
+
+  int n_results = 0;
+  for (size_t i = 0; i < texts.size(); i++) {
+    bool is_new = true;
+    for (Rect region : decoded_) {
+      if ((region & regions[i]).area() > 0) {
+        is_new = false;
+        break;
+      }
+    }
+    if (!is_new) continue;
+    decoded_.push_back(regions[i]);
+    output->push_back(texts[i]);
+    n_results++;
+  }
+  return n_results;
 }
 
 }  // namespace hyf_lemon
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include "datamatrix_decoder.h"
 #include "datamatrix_locator.h"
 #include "datamatrix_reader.h"
+#include "gradient_detector.h"
 #include "image_processor.h"
 
 namespace hyf_lemon {
@@ -50,19 +51,269 @@ class Lemon {
   Lemon();
   ~Lemon();
 
-  bool Decode(std::vector<std::vector<uchar>>* output);
+  /**
+   * @brief decode the image set by SetImage
+   * @param output - if success, output the reult
+   * @param regions - optional, output where each result is found(bounding
+   * rect in the image)
+   * @return true - if success
+   */
+  bool Decode(std::vector<std::vector<uchar>>* output,
+              std::vector<cv::Rect>* regions = NULL);
+  /**
+   * @brief a single take on an image the caller has binarized(at the pyramid
+   * level, by processor().BinarizeShrunk), eg. band by band. no other take
+   * is tried, the settings are left as they are
+   * @param missed - optional, output where each datamatrix located but not
+   * decoded is(bounding rect in the image)
+   * @return count of possible datamatrixs located, decoded or not
+   */
+  int DecodeBinarized(const cv::Mat& image, const cv::Mat& binarized,
+                      std::vector<std::vector<uchar>>* output,
+                      std::vector<cv::Rect>* regions = NULL,
+                      std::vector<cv::Rect>* missed = NULL);
+  const ImageProcessor& processor() const { return processor_; }
   cv::Mat image() const { return image_; };
   void SetImage(const cv::Mat& image);
   void SetReversed(const bool reversed);
   void SetBinMethod(const BinMethod method);
   void SetBinNormalTh(const unsigned val);
   void SetBinAdaptiveBlock(const unsigned val);
+  void SetBinAdaptiveAuto(const bool val);
+  void SetPyramidLevel(const unsigned val);
+  void SetExpectedModule(const unsigned val);
+  /**
+   * @brief the min size(px) of an element that can be located, default 4.
+   * 2~3 for small elements, better read by READ_SAMPLE
+   */
+  void SetMinModule(const unsigned val);
+  /**
+   * @brief cap the memory used for an image: a larger one is decoded tile by
+   * tile, 0(default) means no limit. a limit whose tiles would be smaller
+   * than 64 px is rejected: the limit is unchanged, return false
+   */
+  bool SetMemoryLimit(const size_t bytes);
+  /**
+   * @brief overlap(px) of the tiles, the max size of a datamatrix with its
+   * blank border, default 256. it is cut to half a tile if the memory limit
+   * makes the tiles smaller than 2 overlaps
+   */
+  void SetTileOverlap(const int val);
+  /**
+   * @brief READ_GRID(default): read a warped and binarized image,
+   * READ_SAMPLE: sample the gray image at each element center
+   */
+  void SetReadMethod(const ReadMethod method);
+  /**
+   * @brief READ_SAMPLE only, val*val points are sampled in each element,
+   * default 1
+   */
+  void SetSupersample(const int val);
+  /**
+   * @brief fit the sides of each datamatrix in subpixel, default false
+   */
+  void SetSubpixel(const bool val);
+  /**
+   * @brief simplify the contours to polygons before looking for the L shape,
+   * val: max distance(px) of a point to its polygon, default 0: off
+   */
+  void SetSimplify(const double val);
+  /**
+   * @brief threads to locate, read and decode the candidates, 1: all in the
+   * calling thread, 0(default): as many as OpenCV uses. it is passed to
+   * cv::setNumThreads, which is global for OpenCV
+   */
+  void SetThreads(const int val);
+  /**
+   * @brief stop once val datamatrixs are decoded, default 0: find all
+   */
+  void SetExpectedCount(const int val);
+  /**
+   * @brief stop starting new candidates after ms milliseconds of a Decode,
+   * default 0: no limit
+   */
+  void SetTimeBudget(const double ms);
+  /**
+   * @brief before the binarization takes, look for the L shapes on the
+   * gray image by gradients, default false
+   */
+  void SetGradientDetect(const bool val);
+  /**
+   * @brief correct the lens distortion of each located datamatrix only, not
+   * the whole image. an empty camera_matrix(default) turns it off
+   * @param camera_matrix - 3*3 intrinsics, as cv::calibrateCamera outputs
+   * @param dist_coeffs - k1, k2, p1, p2[, k3]
+   * @return false - if the calibration is not valid(turned off)
+   */
+  bool SetCamera(const cv::Mat& camera_matrix, const cv::Mat& dist_coeffs);
+  /**
+   * @brief where the candidates of the last Decode are dropped: [0] the
+   * gradient pass, [1]-[4] each binarization take(tiles are added up)
+   */
+  const std::vector<RejectStats>& stats() const { return stats_; }
 
  private:
+  bool DecodeFrame(const cv::Mat& image,
+                   std::vector<std::vector<uchar>>* output,
+                   std::vector<cv::Rect>* regions);
+  bool DecodeTiled(std::vector<std::vector<uchar>>* output,
+                   std::vector<cv::Rect>* regions);
+  /**
+   * @brief one binarization take: binarize(unless given), trace, locate,
+   * read and decode
+   * @param binarized - NULL: binarized by processor_, otherwise the image
+   * already binarized at the pyramid level
+   * @param decoded_bounds - input & output, regions decoded in the frame
+   * @param stats - add the candidates to it
+   * @param missed - optional, output the located ones not decoded
+   * @return count of possible datamatrixs located
+   */
+  int DecodeTake(const cv::Mat& image, const cv::Mat* binarized,
+                 std::vector<cv::Rect>* decoded_bounds,
+                 std::vector<std::vector<uchar>>* output,
+                 std::vector<cv::Rect>* regions, RejectStats* stats,
+                 std::vector<cv::Rect>* missed = NULL);
+  /**
+   * @brief locate by GradientDetector, with either polarity
+   * @param decoded_bounds - input & output, regions decoded in the frame
+   * @return true - if any decoded
+   */
+  bool DecodeGradient(const cv::Mat& image,
+                      std::vector<cv::Rect>* decoded_bounds,
+                      std::vector<std::vector<uchar>>* output,
+                      std::vector<cv::Rect>* regions);
+  /**
+   * @brief locate, read and decode candidates best first, wave by wave
+   * @param order - the candidates to try, best first
+   * @param candidate_bounds - bounding rect of each candidate, at the
+   * pyramid level
+   * @param gray - the gray image the L shapes are found on, with l_shapes
+   * @param l_shapes - the candidates, NULL: the contours set to locator_
+   * @param decoded_bounds - input & output, regions decoded in the frame
+   * @param stats - add the candidates to it
+   * @param missed - optional, output the bounds of the located ones not
+   * decoded
+   * @return count of possible datamatrixs located
+   */
+  int DecodeCandidates(const cv::Mat& image, const std::vector<int>& order,
+                       const std::vector<cv::Rect>& candidate_bounds,
+                       const cv::Mat* gray,
+                       const std::vector<LShape>* l_shapes,
+                       std::vector<cv::Rect>* decoded_bounds,
+                       std::vector<std::vector<uchar>>* output,
+                       std::vector<cv::Rect>* regions, RejectStats* stats,
+                       std::vector<cv::Rect>* missed = NULL);
+  /**
+   * @brief read and decode one candidate output by DatamatrixLocator
+   * @param candidate - the Datamatrix image, or the homography if sample
+   * @param reject - output why it is not decoded
+   * @return true - if decoded
+   */
+  bool ReadCandidate(const cv::Mat& image, const cv::Mat& candidate,
+                     const bool sample, std::vector<uchar>* text,
+                     RejectReason* reject) const;
+  /**
+   * @brief true if the expected count is decoded or the time budget is out
+   */
+  bool IsDone(const std::vector<std::vector<uchar>>& output) const;
+
   ImageProcessor processor_;
   DatamatrixLocator locator_;
   DatamatrixReader reader_;
+  GradientDetector detector_;
   cv::Mat image_;
+  size_t memory_limit_;
+  int tile_overlap_;
+  ReadMethod read_method_;
+  int threads_;
+  int expected_count_;
+  double time_budget_;
+  int64_t decode_begin_;
+  bool gradient_detect_;
+  LensModel lens_;
+  std::vector<RejectStats> stats_;
+  // the rough peak bytes each pixel costs while decoding: the copy and
+  // the binarized image of processor, the bits, and the contour points
+  const size_t kBytesPerPixel = 8;
+  // px, the side of the smallest tile: a datamatrix of 10 elements(4 px)
+  // with its blank border
+  const int kMinTile = 64;
+};
+
+/**
+ * @brief decode a line-scan strip while its rows are arriving. rows are kept
+ *        in a window of (max_symbol_rows + band_rows) rows: every time a band
+ *        of new rows is complete, the window is decoded, then only the last
+ *        max_symbol_rows rows are kept. a datamatrix cut by the window bottom
+ *        is filtered out by ImageProcessor and decoded in a later window, the
+ *        ones already output are skipped by their regions.
+ *        the binarized window is kept too, only the new band(and the few
+ *        context rows of the adaptive block above it) is binarized. a window
+ *        is decoded by a single take with the current settings, the other
+ *        takes run only if a candidate is located but not decoded, and it
+ *        is clear of the window bottom(one cut there is decoded later). so
+ *        set binarization etc. before pushing the rows
+ */
+class LemonStream {
+ public:
+  /**
+   * @param width - pixels of each row(8-bit gray)
+   * @param max_symbol_rows - the max height of a datamatrix with its blank
+   * border, in rows
+   * @param band_rows - new rows needed to decode the window again
+   * both rows are rounded up to whole pixels of the coarsest pyramid level
+   */
+  LemonStream(const int width, const int max_symbol_rows,
+              const int band_rows);
+  ~LemonStream();
+
+  /**
+   * @brief push rows of the strip
+   * @param ptr - the first row
+   * @param n_rows - count of rows
+   * @param stride - bytes between 2 rows
+   * @param output - output the results decoded by the rows pushed
+   * @return count of new results
+   */
+  int PushRows(const uchar* ptr, const int n_rows, const int stride,
+               std::vector<std::vector<uchar>>* output);
+  /**
+   * @brief decode the rows left at the end of a strip, then reset
+   */
+  int Flush(std::vector<std::vector<uchar>>* output);
+  void Reset();
+  // set binarization etc. through it
+  Lemon* lemon() { return &lemon_; }
+
+ private:
+  /**
+   * @param last - no rows follow: a candidate at the window bottom can not
+   * be decoded later
+   */
+  int DecodeWindow(std::vector<std::vector<uchar>>* output, const bool last);
+  /**
+   * @brief binarize the rows filled since the last call, at the pyramid
+   * level, into binary_
+   * @return rows of window_ binarized, a whole count of pyramid pixels
+   */
+  int BinarizeRows();
+
+  Lemon lemon_;
+  cv::Mat window_;
+  // window_ binarized, at the pyramid level
+  cv::Mat binary_;
+  int binary_scale_;
+  // rows of window_ binarized in binary_, the last context rows of them
+  // are binarized again with the next band
+  int binarized_rows_;
+  int overlap_rows_;
+  int band_rows_;
+  // rows filled in window_
+  int filled_;
+  // rows already decoded in window_
+  int decoded_rows_;
+  // regions of the results in window_
+  std::vector<cv::Rect> decoded_;
 };
 
 namespace {
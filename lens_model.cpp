@@ -0,0 +1,101 @@
+/*******************************************************************************
+
+  @file      lens_model.cpp
+  @brief     camera intrinsics and lens distortion, to map single points
+             between the raw image and the undistorted one
+  @details   ~
+  @author    LemonDecoder contributors
+  @date      18.10.2026
+  @copyright LemonDecoder contributors, 2026. MIT License(see LICENSE.txt)
+
+*******************************************************************************/
+#include "lens_model.h"
+
+#include <math.h>
+
+using namespace cv;
+
+namespace hyf_lemon {
+
+LensModel::LensModel() { Reset(); }
+LensModel::~LensModel() {}
+
+void LensModel::Reset() {
+  empty_ = true;
+  fx_ = fy_ = 1.0;
+  cx_ = cy_ = 0.0;
+  k1_ = k2_ = p1_ = p2_ = k3_ = 0.0;
+  offset_ = Point2d(0.0, 0.0);
+}
+
+bool LensModel::Set(const Mat& camera_matrix, const Mat& dist_coeffs) {
+  Reset();
+  if (camera_matrix.rows != 3 || camera_matrix.cols != 3) return false;
+  const int n_coeffs = (int)dist_coeffs.total();
+  if (n_coeffs < 4) return false;
+  Mat k, d;
+  camera_matrix.convertTo(k, CV_64F);
+  dist_coeffs.reshape(1, 1).convertTo(d, CV_64F);
+  const double* coeffs = d.ptr<double>(0);
+  fx_ = k.at<double>(0, 0);
+  fy_ = k.at<double>(1, 1);
+  cx_ = k.at<double>(0, 2);
+  cy_ = k.at<double>(1, 2);
+  if (fx_ <= 0.0 || fy_ <= 0.0) {
+    Reset();
+    return false;
+  }
+  k1_ = coeffs[0];
+  k2_ = coeffs[1];
+  p1_ = coeffs[2];
+  p2_ = coeffs[3];
+  k3_ = n_coeffs > 4 ? coeffs[4] : 0.0;
+  empty_ = false;
+  return true;
+}
+
+Point2d LensModel::Distort(const Point2d& point) const {
+  if (empty_) return point;
+  // normalized camera coordinates
+  const double x = (point.x + offset_.x - cx_) / fx_;
+  const double y = (point.y + offset_.y - cy_) / fy_;
+  const double r2 = x * x + y * y;
+  const double radial = 1.0 + r2 * (k1_ + r2 * (k2_ + r2 * k3_));
+  const double xd = x * radial + 2.0 * p1_ * x * y + p2_ * (r2 + 2.0 * x * x);
+  const double yd = y * radial + p1_ * (r2 + 2.0 * y * y) + 2.0 * p2_ * x * y;
+  return Point2d(xd * fx_ + cx_ - offset_.x, yd * fy_ + cy_ - offset_.y);
+}
+
+Point2d LensModel::Undistort(const Point2d& point) const {
+  /* the distortion has no closed inverse: solve distort(x, y) == point by
+   * Newton's method from the point itself. the fixed point iteration of
+   * cv::undistortPoints diverges at the corners of a strong barrel. */
+  if (empty_) return point;
+  const double x0 = (point.x + offset_.x - cx_) / fx_;
+  const double y0 = (point.y + offset_.y - cy_) / fy_;
+  double x = x0, y = y0;
+  for (int i = 0; i < kIterations; i++) {
+    const double r2 = x * x + y * y;
+    const double radial = 1.0 + r2 * (k1_ + r2 * (k2_ + r2 * k3_));
+    // d(radial) / d(r2)
+    const double slope = k1_ + r2 * (2.0 * k2_ + 3.0 * r2 * k3_);
+    const double ex = x * radial + 2.0 * p1_ * x * y +
+                      p2_ * (r2 + 2.0 * x * x) - x0;
+    const double ey = y * radial + p1_ * (r2 + 2.0 * y * y) +
+                      2.0 * p2_ * x * y - y0;
+    if (fabs(ex) + fabs(ey) < kEpsilon) break;
+    // jacobian
+    const double a = radial + 2.0 * x * x * slope + 2.0 * p1_ * y +
+                     6.0 * p2_ * x;
+    const double b = 2.0 * x * y * slope + 2.0 * p1_ * x + 2.0 * p2_ * y;
+    const double d = radial + 2.0 * y * y * slope + 6.0 * p1_ * y +
+                     2.0 * p2_ * x;
+    const double det = a * d - b * b;
+    if (fabs(det) < kEpsilon) break;
+    x -= (d * ex - b * ey) / det;
+    y -= (a * ey - b * ex) / det;
+  }
+  return Point2d(x * fx_ + cx_ - offset_.x, y * fy_ + cy_ - offset_.y);
+}
+
+}  // namespace hyf_lemon
@@ -0,0 +1,72 @@
+/*******************************************************************************
+
+  @file      lens_model.h
+  @brief     camera intrinsics and lens distortion, to map single points
+             between the raw image and the undistorted one
+  @details   ~
+  @author    LemonDecoder contributors
+  @date      18.10.2026
+  @copyright LemonDecoder contributors, 2026. MIT License(see LICENSE.txt)
+
+*******************************************************************************/
+#ifndef LENS_MODEL_H_
+#define LENS_MODEL_H_
+
+#include <opencv2/opencv.hpp>
+
+namespace hyf_lemon {
+
+/**
+  @class   LensModel
+  @brief   the Brown-Conrady model as OpenCV calibrates it(k1, k2, p1, p2,
+           k3). the undistorted image keeps the same camera matrix, so a
+           point moves only by the distortion. no full frame is remapped:
+           only the points asked for are mapped.
+  @details an empty model(default) maps every point to itself
+**/
+class LensModel {
+ public:
+  LensModel();
+  ~LensModel();
+
+  /**
+    @brief  set the calibration
+    @param  camera_matrix - 3*3 intrinsics(fx, 0, cx; 0, fy, cy; 0, 0, 1)
+    @param  dist_coeffs   - k1, k2, p1, p2[, k3], the rest is ignored
+    @retval               - false : if the input is not valid, left empty
+  **/
+  bool Set(const cv::Mat& camera_matrix, const cv::Mat& dist_coeffs);
+  void Reset();
+  bool empty() const { return empty_; }
+
+  cv::Point2d offset() const { return offset_; }
+  /**
+    @brief where the image mapped is in the frame calibrated, eg. a tile
+  **/
+  void set_offset(const cv::Point2d& val) { offset_ = val; }
+
+  /**
+    @brief a point of the undistorted image -> where it is in the raw image
+  **/
+  cv::Point2d Distort(const cv::Point2d& point) const;
+  /**
+    @brief a point of the raw image -> where it is in the undistorted image,
+           solved by Newton's method
+  **/
+  cv::Point2d Undistort(const cv::Point2d& point) const;
+
+ private:
+  // iterations of Undistort, enough for the barrel of a wide angle lens
+  static const int kIterations = 10;
+  // in normalized coordinates, far below 0.01px
+  static constexpr double kEpsilon = 1e-10;
+
+  bool empty_;
+  double fx_, fy_, cx_, cy_;
+  double k1_, k2_, p1_, p2_, k3_;
+  cv::Point2d offset_;
+};
+
+}  // namespace hyf_lemon
+
+#endif  // LENS_MODEL_H_
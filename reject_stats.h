@@ -0,0 +1,84 @@
+/*******************************************************************************
+
+  @file      reject_stats.h
+  @brief     why candidates are rejected along the locate/read/decode chain
+  @details   ~
+  @author    LemonDecoder contributors
+  @date      18.10.2026
+  @copyright LemonDecoder contributors, 2026. MIT License(see LICENSE.txt)
+
+*******************************************************************************/
+#ifndef REJECT_STATS_H_
+#define REJECT_STATS_H_
+
+namespace hyf_lemon {
+
+/**
+  @enum  hyf_lemon::RejectReason
+  @brief where a candidate is dropped, in the order of the chain
+**/
+enum RejectReason {
+  REJECT_NONE = -1,
+  REJECT_L_SHAPE,       // locator: no L shape in the contour
+  REJECT_CALIBRATE,     // locator: the sides of the L can not be calibrated
+  REJECT_BLANK_L,       // locator: no blank border beside the L
+  REJECT_PX,            // locator: no timing side(SetPx)
+  REJECT_ENLARGE,       // locator: too close to the image border
+  REJECT_THUMBNAIL,     // locator: no timing sides in the thumbnail
+  REJECT_PX_WARPED,     // locator: no timing side(SetPx) on the warped image
+  REJECT_PADDING_DASH,  // reader: the timing sides can not be trimmed
+  REJECT_CODE_SIZE,     // reader: too few elements counted
+  REJECT_GRID,          // odd or undersized grid
+  REJECT_REPAIR,        // decoder: too many errors to repair
+  REJECT_MESSAGE,       // decoder: the codewords are not a message
+  REJECT_REASONS        // count of the reasons
+};
+
+/**
+  @brief short name of a reason, for logs
+**/
+inline const char* RejectName(const RejectReason reason) {
+  static const char* const kNames[REJECT_REASONS] = {
+      "l_shape",   "calibrate", "blank_l",      "px",
+      "enlarge",   "thumbnail", "px_warped",    "padding_dash",
+      "code_size", "grid",      "repair",       "message"};
+  return reason > REJECT_NONE && reason < REJECT_REASONS ? kNames[reason]
+                                                         : "none";
+}
+
+/**
+  @struct RejectStats
+  @brief  counters of one pass over the candidates(a take), each candidate is
+          counted once: either decoded, skipped or by the reason rejected
+**/
+struct RejectStats {
+  // tried by the locator
+  int candidates;
+  // overlapping a datamatrix decoded earlier, not tried
+  int skipped;
+  int decoded;
+  int rejects[REJECT_REASONS];
+  // milliseconds spent, binarization included
+  double ms;
+
+  RejectStats() { Reset(); }
+  void Reset() {
+    candidates = skipped = decoded = 0;
+    for (int i = 0; i < REJECT_REASONS; i++) rejects[i] = 0;
+    ms = 0.0;
+  }
+  void Add(const RejectStats& other) {
+    candidates += other.candidates;
+    skipped += other.skipped;
+    decoded += other.decoded;
+    for (int i = 0; i < REJECT_REASONS; i++) rejects[i] += other.rejects[i];
+    ms += other.ms;
+  }
+  void Count(const RejectReason reason) {
+    if (reason > REJECT_NONE && reason < REJECT_REASONS) rejects[reason]++;
+  }
+};
+
+}  // namespace hyf_lemon
+
+#endif  // REJECT_STATS_H_